@@ -0,0 +1,123 @@
+#!/bin/sh
+# bench.sh — Benchmark harness: solution quality and solver time per problem
+#
+# Usage:
+#   ./bench.sh run [-n RUNS] [-o OUT.csv] <problem.json>...
+#   ./bench.sh diff [-t TIME_TOL_PCT] <baseline.csv> <new.csv>
+#
+# run solves every problem RUNS times (default 3) with ./mlsys, checks the
+# last solution with ./verify and writes one CSV row per problem:
+#   problem      file name without .json
+#   ops          op count
+#   runs         solves timed
+#   wall_ms      median wall-clock time of a solve, process start to exit
+#   fusion_ms    median time in greedy fusion (mlsys "Fusion:" line)
+#   greedy_ms    median time to the first complete schedule
+#   solve_ms     median time to the final write (mlsys "Solution written")
+#   rss_mb       peak RSS of the last solve
+#   latency      total reported latency of the last solve (deterministic per
+#                input), read back by verify at full precision
+#   unfused      verify's unfused baseline
+#   speedup      unfused / latency
+#   verify       PASS or FAIL
+#
+# diff matches rows by problem and exits 1 on any regression: a higher
+# latency, a verify result that turns to FAIL, or a median wall time more
+# than TIME_TOL_PCT percent (default 20) and 50 ms slower. Problems missing
+# from either file are listed but are not regressions.
+
+set -eu
+
+MLSYS=${MLSYS:-./mlsys}
+VERIFY=${VERIFY:-./verify}
+
+now_ms() { echo $(($(date +%s%N) / 1000000)); }
+
+# Median of the numbers on stdin, one per line
+median() { sort -g | awk '{ v[NR] = $1 } END { if (NR) print v[int((NR + 1) / 2)]; else print "" }'; }
+
+run() {
+    runs=3 out=bench.csv
+    while getopts n:o: opt; do
+        case $opt in
+            n) runs=$OPTARG ;;
+            o) out=$OPTARG ;;
+            *) exit 2 ;;
+        esac
+    done
+    shift $((OPTIND - 1))
+    [ $# -gt 0 ] || { echo "bench.sh run: no problem files" >&2; exit 2; }
+
+    tmp=$(mktemp -d)
+    trap 'rm -rf "$tmp"' EXIT
+    echo "problem,ops,runs,wall_ms,fusion_ms,greedy_ms,solve_ms,rss_mb,latency,unfused,speedup,verify" > "$out"
+    for f in "$@"; do
+        name=$(basename "$f" .json)
+        : > "$tmp/wall"; : > "$tmp/fusion"; : > "$tmp/greedy"; : > "$tmp/solve"
+        i=0
+        while [ $i -lt "$runs" ]; do
+            t0=$(now_ms)
+            "$MLSYS" "$f" "$tmp/out.json" 2> "$tmp/log" || true
+            echo $(($(now_ms) - t0)) >> "$tmp/wall"
+            sed -n 's/^Fusion: .*(\([0-9.e+-]*\) ms.*/\1/p' "$tmp/log" | head -1 >> "$tmp/fusion"
+            sed -n 's/^Greedy latency: .*(\([0-9.e+-]*\) ms)/\1/p' "$tmp/log" >> "$tmp/greedy"
+            sed -n 's/^Solution written .* \([0-9.e+-]*\) ms)/\1/p' "$tmp/log" >> "$tmp/solve"
+            i=$((i + 1))
+        done
+        ops=$(sed -n 's/^Problem: [0-9]* tensors, \([0-9]*\) ops.*/\1/p' "$tmp/log")
+        rss=$(sed -n 's/^Peak RSS: \([0-9]*\) MB/\1/p' "$tmp/log")
+        "$VERIFY" "$f" "$tmp/out.json" > "$tmp/verify" 2>&1 || true
+        lat=$(sed -n 's/^\[INFO\] Total reported latency: *//p' "$tmp/verify")
+        unfused=$(sed -n 's/^\[INFO\] Unfused baseline: *//p' "$tmp/verify")
+        if grep -q "ALL CHECKS PASSED" "$tmp/verify"; then ok=PASS; else ok=FAIL; fi
+        speedup=$(awk -v u="$unfused" -v l="$lat" 'BEGIN { if (l > 0 && u != "") printf "%.4f", u / l }')
+        row="$name,$ops,$runs,$(median < "$tmp/wall"),$(median < "$tmp/fusion"),$(median < "$tmp/greedy")"
+        row="$row,$(median < "$tmp/solve"),$rss,$lat,$unfused,$speedup,$ok"
+        echo "$row" >> "$out"
+        echo "$row" >&2
+    done
+    echo "Wrote $out" >&2
+}
+
+diff_csv() {
+    tol=20
+    while getopts t: opt; do
+        case $opt in
+            t) tol=$OPTARG ;;
+            *) exit 2 ;;
+        esac
+    done
+    shift $((OPTIND - 1))
+    [ $# -eq 2 ] || { echo "Usage: ./bench.sh diff [-t TIME_TOL_PCT] <baseline.csv> <new.csv>" >&2; exit 2; }
+
+    awk -F, -v tol="$tol" '
+        FNR == 1 { next }
+        NR == FNR { base[$1] = $0; next }
+        {
+            seen[$1] = 1
+            if (!($1 in base)) { printf "%-24s new (no baseline)\n", $1; next }
+            split(base[$1], b, ",")
+            dlat = b[9] > 0 ? 100 * ($9 - b[9]) / b[9] : 0
+            dwall = b[4] > 0 ? 100 * ($4 - b[4]) / b[4] : 0
+            flag = ""
+            if ($9 > b[9] * (1 + 1e-9)) flag = flag " LATENCY"
+            if ($12 != "PASS" && b[12] == "PASS") flag = flag " VERIFY"
+            if (dwall > tol && $4 - b[4] > 50) flag = flag " TIME"
+            if (flag != "") bad++
+            printf "%-24s latency %+.3f%% (%s -> %s)  wall %+.1f%% (%s -> %s ms)  %s%s\n",
+                   $1, dlat, b[9], $9, dwall, b[4], $4, $12, flag == "" ? "" : "  REGRESSION:" flag
+        }
+        END {
+            for (k in base) if (!(k in seen)) printf "%-24s missing from new run\n", k
+            if (bad) { printf "%d regression(s)\n", bad; exit 1 }
+            print "No regressions"
+        }' "$1" "$2"
+}
+
+cmd=${1:-}
+[ $# -gt 0 ] && shift
+case $cmd in
+    run) run "$@" ;;
+    diff) diff_csv "$@" ;;
+    *) sed -n '3,6p' "$0" | sed 's/^# \{0,1\}//' >&2; exit 2 ;;
+esac
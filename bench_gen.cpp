@@ -0,0 +1,199 @@
+// bench_gen.cpp — Synthetic problem generator for scaling runs
+// Usage: ./bench_gen [--dim=D] [--cap=BYTES] [--bw=B] [--seed=S]
+//                    <transformer|mlp|attention|residual|prenorm> <ops> <output.json>
+//
+// Emits a DAG in the benchmark schema with exactly <ops> ops, built by
+// repeating one block of the chosen family:
+//   mlp          x·W1 → act → ·W2                          (3 ops)
+//   attention    Q, Kᵀ, V projections, QKᵀ, softmax, ·V    (6 ops)
+//   residual     norm → x·W → add(x, ·)                    (3 ops)
+//   transformer  4 attention heads, per-head output
+//                projections summed, residual add, MLP,
+//                residual add                              (36 ops)
+//   prenorm      norm → Q, Kᵀ, V projections (D = dim/2) → QKᵀ → scale
+//                → exp → ·V → out-projection → residual add,
+//                with cheap (50) Pointwise ops                (10 ops)
+// Each block reads the previous block's output, so the graph is one long
+// chain of blocks with wide fan-out inside them; weights are graph inputs.
+// A short Pointwise tail pads the count. Sequence length equals --dim, so
+// the layer input can serve directly as the RHS of the Kᵀ projection.
+// Base costs are jittered ±25% from --seed, so sizes are reproducible.
+// --bw defaults to 20, where a MatMul tile moves more than it computes and
+// fusion has something to save. At 100 every family was compute-bound and
+// solved to the compute floor whatever was fused.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Gen {
+    int64_t dim;
+    mt19937 rng;
+    vector<int64_t> widths, heights;
+    vector<vector<int>> inputs, outputs;
+    vector<int64_t> costs;
+    vector<const char*> types;
+
+    int tensor(int64_t w, int64_t h) {
+        widths.push_back(w);
+        heights.push_back(h);
+        return (int)widths.size() - 1;
+    }
+
+    int64_t jitter(int64_t base) {
+        return uniform_int_distribution<int64_t>(base * 3 / 4, base * 5 / 4)(rng);
+    }
+
+    int emit(const char* type, vector<int> in, int64_t w, int64_t h, int64_t cost) {
+        int out = tensor(w, h);
+        types.push_back(type);
+        inputs.push_back(move(in));
+        outputs.push_back({out});
+        costs.push_back(jitter(cost));
+        return out;
+    }
+
+    // lhs is K wide and H tall, rhs W wide and K tall; the output is W×H
+    int matmul(int lhs, int rhs) {
+        return emit("MatMul", {lhs, rhs}, widths[rhs], heights[lhs], 4000);
+    }
+    int pointwise(vector<int> in, int64_t cost = 500) {
+        int64_t w = widths[in[0]], h = heights[in[0]];
+        return emit("Pointwise", move(in), w, h, cost);
+    }
+    int weight(int64_t w, int64_t h) { return tensor(w, h); }
+
+    int ops() const { return (int)types.size(); }
+
+    // --- Block families; x is dim×dim ---
+    int mlp(int x) {
+        int up = matmul(x, weight(2 * dim, dim));
+        int act = pointwise({up});
+        return matmul(act, weight(dim, 2 * dim));
+    }
+    int head(int x, int64_t dh) {
+        int q = matmul(x, weight(dh, dim));           // dh×S
+        int kt = matmul(weight(dim, dh), x);          // S×dh
+        int v = matmul(x, weight(dh, dim));           // dh×S
+        int scores = matmul(q, kt);                   // S×S
+        int probs = pointwise({scores});
+        return matmul(probs, v);                      // dh×S
+    }
+    int attention(int x) { return head(x, dim / 4); }
+    int residual(int x) {
+        int norm = pointwise({x});
+        int proj = matmul(norm, weight(dim, dim));
+        return pointwise({x, proj});
+    }
+    // Pointwise ops cost a tenth of the other families', so cloning them
+    // into their MatMul readers (recomputation) can pay off
+    int prenorm(int x) {
+        int64_t dh = dim / 2;
+        int norm = pointwise({x}, 50);
+        int q = matmul(norm, weight(dh, dim));        // dh×S
+        int kt = matmul(weight(dim, dh), norm);       // S×dh
+        int v = matmul(norm, weight(dh, dim));        // dh×S
+        int scores = matmul(q, kt);                   // S×S
+        int probs = pointwise({pointwise({scores}, 50)}, 50);
+        int proj = matmul(matmul(probs, v), weight(dim, dh));
+        return pointwise({x, proj}, 50);
+    }
+    int transformer(int x) {
+        const int heads = 4;
+        int64_t dh = dim / heads;
+        int sum = -1;
+        for (int i = 0; i < heads; i++) {
+            int o = matmul(head(x, dh), weight(dim, dh));
+            sum = sum < 0 ? o : pointwise({sum, o});
+        }
+        int h = pointwise({x, sum});
+        return pointwise({h, mlp(h)});
+    }
+};
+
+static int block_ops(const string& family) {
+    if (family == "mlp" || family == "residual") return 3;
+    if (family == "attention") return 6;
+    if (family == "transformer") return 36;
+    if (family == "prenorm") return 10;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    vector<const char*> args;
+    int64_t dim = 512, cap = 0, bw = 20;
+    unsigned seed = 1;
+    bool bad = false;
+    for (int i = 1; i < argc; i++) {
+        string a = argv[i];
+        if (a.rfind("--dim=", 0) == 0) dim = atoll(a.c_str() + 6);
+        else if (a.rfind("--cap=", 0) == 0) cap = atoll(a.c_str() + 6);
+        else if (a.rfind("--bw=", 0) == 0) bw = atoll(a.c_str() + 5);
+        else if (a.rfind("--seed=", 0) == 0) seed = (unsigned)atoll(a.c_str() + 7);
+        else if (a.rfind("--", 0) == 0) {
+            cerr << "Unknown option " << a << endl;
+            bad = true;
+        } else args.push_back(argv[i]);
+    }
+    string family = args.size() == 3 ? args[0] : "";
+    int nops = args.size() == 3 ? atoi(args[1]) : 0;
+    if (bad || block_ops(family) == 0 || nops <= 0 || dim < 128 || dim % 128 != 0) {
+        cerr << "Usage: ./bench_gen [--dim=D] [--cap=BYTES] [--bw=B] [--seed=S] "
+                "<transformer|mlp|attention|residual|prenorm> <ops> <output.json>" << endl;
+        cerr << "  D is a multiple of 128 (default 512); the default capacity holds "
+                "three dim×dim tensors; the default bandwidth (20) leaves MatMuls "
+                "memory-bound" << endl;
+        return 1;
+    }
+    if (cap <= 0) cap = 3 * dim * dim;
+
+    Gen g{dim, mt19937(seed), {}, {}, {}, {}, {}, {}};
+    int x = g.tensor(dim, dim);
+    while (g.ops() + block_ops(family) <= nops) {
+        if (family == "mlp") x = g.mlp(x);
+        else if (family == "attention") x = g.attention(x);
+        else if (family == "residual") x = g.residual(x);
+        else if (family == "prenorm") x = g.prenorm(x);
+        else x = g.transformer(x);
+    }
+    while (g.ops() < nops) x = g.pointwise({x});
+
+    FILE* f = fopen(args[2], "w");
+    if (!f) { cerr << "Cannot write " << args[2] << endl; return 1; }
+    auto ints = [&](const char* key, const vector<int64_t>& v) {
+        fprintf(f, "  \"%s\": [", key);
+        for (size_t i = 0; i < v.size(); i++) fprintf(f, "%s%lld", i ? ", " : "", (long long)v[i]);
+        fprintf(f, "],\n");
+    };
+    auto lists = [&](const char* key, const vector<vector<int>>& v) {
+        fprintf(f, "  \"%s\": [", key);
+        for (size_t i = 0; i < v.size(); i++) {
+            fprintf(f, "%s[", i ? ", " : "");
+            for (size_t j = 0; j < v[i].size(); j++) fprintf(f, "%s%d", j ? ", " : "", v[i][j]);
+            fprintf(f, "]");
+        }
+        fprintf(f, "],\n");
+    };
+    fprintf(f, "{\n");
+    ints("widths", g.widths);
+    ints("heights", g.heights);
+    lists("inputs", g.inputs);
+    lists("outputs", g.outputs);
+    ints("base_costs", g.costs);
+    fprintf(f, "  \"op_types\": [");
+    for (size_t i = 0; i < g.types.size(); i++) fprintf(f, "%s\"%s\"", i ? ", " : "", g.types[i]);
+    fprintf(f, "],\n");
+    fprintf(f, "  \"fast_memory_capacity\": %lld,\n", (long long)cap);
+    fprintf(f, "  \"slow_memory_bandwidth\": %lld,\n", (long long)bw);
+    fprintf(f, "  \"native_granularity\": [128, 128]\n}\n");
+    fclose(f);
+    cerr << family << ": " << g.ops() << " ops, " << g.widths.size() << " tensors -> "
+         << args[2] << endl;
+    return 0;
+}
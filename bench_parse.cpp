@@ -0,0 +1,203 @@
+// bench_parse.cpp — Problem reader throughput check
+// Usage: ./bench_parse <input.json>
+//
+// Times read_problem() (the mmap + JsonCursor reader in mlsys_core) against
+// the old recursive DOM reader it replaced, and checks that both build the
+// same Problem. The DOM reader lives only here, as the reference.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "mlsys_core.h"
+
+using namespace std;
+
+// ============================================================
+// DOM JSON parser (the old reader)
+// ============================================================
+
+struct JVal {
+    enum T { NUL, NUM, STR, ARR, OBJ } t = NUL;
+    double n = 0;
+    string s;
+    vector<JVal> a;
+    vector<pair<string, JVal>> o;
+
+    const JVal& operator[](const char* key) const {
+        for (auto& [k, v] : o)
+            if (k == key) return v;
+        static JVal nil;
+        return nil;
+    }
+    const JVal& operator[](size_t i) const { return a[i]; }
+    int sz() const { return t == ARR ? (int)a.size() : (int)o.size(); }
+    int64_t i64() const { return (int64_t)n; }
+};
+
+JVal jparse(const string& s, size_t& p) {
+    auto ws = [&] { while (p < s.size() && isspace(s[p])) p++; };
+    ws();
+    if (p >= s.size()) return {};
+    if (s[p] == '{') {
+        JVal v;
+        v.t = JVal::OBJ;
+        p++;
+        ws();
+        while (p < s.size() && s[p] != '}') {
+            auto k = jparse(s, p);
+            ws();
+            if (p < s.size() && s[p] == ':') p++;
+            auto val = jparse(s, p);
+            v.o.push_back({k.s, val});
+            ws();
+            if (p < s.size() && s[p] == ',') p++;
+        }
+        if (p < s.size()) p++;
+        return v;
+    }
+    if (s[p] == '[') {
+        JVal v;
+        v.t = JVal::ARR;
+        p++;
+        ws();
+        while (p < s.size() && s[p] != ']') {
+            v.a.push_back(jparse(s, p));
+            ws();
+            if (p < s.size() && s[p] == ',') p++;
+        }
+        if (p < s.size()) p++;
+        return v;
+    }
+    if (s[p] == '"') {
+        JVal v;
+        v.t = JVal::STR;
+        p++;
+        while (p < s.size() && s[p] != '"') v.s += s[p++];
+        if (p < s.size()) p++;
+        return v;
+    }
+    if (s[p] == 'n') {
+        p += 4;
+        return {};
+    }
+    // number
+    JVal v;
+    v.t = JVal::NUM;
+    size_t start = p;
+    if (s[p] == '-') p++;
+    while (p < s.size() && isdigit(s[p])) p++;
+    if (p < s.size() && s[p] == '.') {
+        p++;
+        while (p < s.size() && isdigit(s[p])) p++;
+    }
+    if (p < s.size() && (s[p] == 'e' || s[p] == 'E')) {
+        p++;
+        if (p < s.size() && (s[p] == '+' || s[p] == '-')) p++;
+        while (p < s.size() && isdigit(s[p])) p++;
+    }
+    v.n = stod(s.substr(start, p - start));
+    return v;
+}
+
+JVal jparse(const string& s) {
+    size_t p = 0;
+    return jparse(s, p);
+}
+
+// Builds the Problem from a JVal tree; --bench-parse times it against
+// read_problem.
+Problem read_problem_dom(const char* path) {
+    ifstream f(path);
+    if (!f) { cerr << "Cannot open " << path << endl; exit(1); }
+    stringstream ss;
+    ss << f.rdbuf();
+    auto j = jparse(ss.str());
+
+    Problem p;
+    int nt = j["widths"].sz();
+    p.tensors.resize(nt);
+    for (int i = 0; i < nt; i++)
+        p.tensors[i] = {j["widths"][(size_t)i].i64(), j["heights"][(size_t)i].i64()};
+
+    int no = j["inputs"].sz();
+    p.ops.resize(no);
+    p.in_off.assign(no + 1, 0);
+    p.out_off.assign(no + 1, 0);
+    for (int i = 0; i < no; i++) {
+        const JVal& ins = j["inputs"][(size_t)i];
+        const JVal& outs = j["outputs"][(size_t)i];
+        for (int k = 0; k < ins.sz(); k++) p.in_idx.push_back((int)ins[(size_t)k].i64());
+        for (int k = 0; k < outs.sz(); k++) p.out_idx.push_back((int)outs[(size_t)k].i64());
+        p.in_off[i + 1] = (int)p.in_idx.size();
+        p.out_off[i + 1] = (int)p.out_idx.size();
+        Op& op = p.ops[i];
+        op.kind = j["op_types"][(size_t)i].s == "MatMul" ? OpKind::MatMul : OpKind::Pointwise;
+        op.base_cost = j["base_costs"][(size_t)i].i64();
+        op.K = op.kind == OpKind::MatMul ? p.tensors[p.in_idx[p.in_off[i]]].w : 0;
+    }
+    p.fast_cap = j["fast_memory_capacity"].i64();
+    p.slow_bw = j["slow_memory_bandwidth"].i64();
+    p.nat_w = j["native_granularity"][(size_t)0].i64();
+    p.nat_h = j["native_granularity"][(size_t)1].i64();
+    derive_problem(p);
+    return p;
+}
+
+// ============================================================
+// Benchmark
+// ============================================================
+
+// Times read_problem against the DOM reader on one file (rounds until each
+// has run 200 ms) and checks that both build the same Problem.
+void bench_parse(const char* path) {
+    struct stat st;
+    double mb = stat(path, &st) == 0 ? st.st_size / 1e6 : 0;
+    auto same = [](const Problem& a, const Problem& b) {
+        auto eq_t = [](const Tensor& x, const Tensor& y) { return x.w == y.w && x.h == y.h; };
+        auto eq_o = [](const Op& x, const Op& y) {
+            return x.kind == y.kind && x.base_cost == y.base_cost && x.K == y.K;
+        };
+        return equal(a.tensors.begin(), a.tensors.end(), b.tensors.begin(), b.tensors.end(), eq_t) &&
+               equal(a.ops.begin(), a.ops.end(), b.ops.begin(), b.ops.end(), eq_o) &&
+               a.in_off == b.in_off && a.in_idx == b.in_idx && a.out_off == b.out_off &&
+               a.out_idx == b.out_idx && a.cons_idx == b.cons_idx && a.fast_cap == b.fast_cap &&
+               a.slow_bw == b.slow_bw && a.nat_w == b.nat_w && a.nat_h == b.nat_h;
+    };
+    auto time = [&](Problem (*reader)(const char*), Problem& out) {
+        int rounds = 0;
+        auto t0 = chrono::steady_clock::now();
+        double sec = 0;
+        for (; sec < 0.2 || rounds < 3; rounds++) {
+            out = reader(path);
+            sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        }
+        return sec / rounds;
+    };
+    Problem dom, sax;
+    // read_problem first: it rejects malformed files the DOM reader trusts
+    double t_sax = time(read_problem, sax);
+    double t_dom = time(read_problem_dom, dom);
+    cerr << "bench-parse: " << mb << " MB, " << sax.tensors.size() << " tensors, " << sax.ops.size()
+         << " ops" << endl;
+    cerr << "  dom  " << t_dom * 1e3 << " ms (" << mb / t_dom << " MB/s)" << endl;
+    cerr << "  mmap " << t_sax * 1e3 << " ms (" << mb / t_sax << " MB/s), " << t_dom / t_sax
+         << "x faster" << (same(dom, sax) ? "" : ", PROBLEMS DIFFER") << endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        cerr << "Usage: ./bench_parse <input.json>" << endl;
+        return 1;
+    }
+    bench_parse(argv[1]);
+    return 0;
+}
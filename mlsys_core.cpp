@@ -0,0 +1,805 @@
+// mlsys_core.cpp — see mlsys_core.h
+
+#include "mlsys_core.h"
+
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// ============================================================
+// Profiling
+// ============================================================
+
+bool g_profile = false;
+atomic<uint64_t> g_prof_counts[(int)Prof::Count];
+
+namespace {
+
+struct Span {
+    const char* name;
+    int64_t start, dur;
+    int tid;
+};
+
+// Beyond this many spans (~24 MB) further ones are only counted, so a long
+// anneal or LNS run cannot grow the trace without bound
+constexpr size_t kMaxSpans = 1 << 20;
+
+chrono::steady_clock::time_point g_prof_start;
+mutex g_span_mu;
+vector<Span> g_spans;
+uint64_t g_spans_dropped = 0;
+atomic<int> g_next_tid{0};
+
+const char* const kProfNames[] = {"find_best_gran", "analyze", "cycle_query",
+                                  "creates_cycle", "calc_latency", "gran_tried",
+                                  "gran_cap_reject"};
+static_assert(sizeof(kProfNames) / sizeof(kProfNames[0]) == (size_t)Prof::Count,
+              "one name per counter");
+
+int prof_tid() {
+    static thread_local int tid = g_next_tid++;
+    return tid;
+}
+
+}  // namespace
+
+void prof_enable() {
+    g_prof_start = chrono::steady_clock::now();
+    for (auto& c : g_prof_counts) c.store(0, memory_order_relaxed);
+    g_spans.reserve(4096);
+    g_profile = true;
+}
+
+int64_t prof_now_us() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() -
+                                                       g_prof_start).count();
+}
+
+void prof_span(const char* name, int64_t start_us, int64_t dur_us) {
+    int tid = prof_tid();
+    lock_guard<mutex> lk(g_span_mu);
+    if (g_spans.size() >= kMaxSpans) { g_spans_dropped++; return; }
+    g_spans.push_back({name, start_us, dur_us, tid});
+}
+
+bool prof_write_trace(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    lock_guard<mutex> lk(g_span_mu);
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+               "\"args\": {\"name\": \"mlsys\"}}");
+    for (const Span& sp : g_spans)
+        fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %lld, \"dur\": %lld, "
+                   "\"pid\": 1, \"tid\": %d}",
+                sp.name, (long long)sp.start, (long long)sp.dur, sp.tid);
+    fprintf(f, ",\n{\"name\": \"counters\", \"ph\": \"C\", \"ts\": %lld, \"pid\": 1, "
+               "\"args\": {", (long long)prof_now_us());
+    for (int i = 0; i < (int)Prof::Count; i++)
+        fprintf(f, "%s\"%s\": %llu", i ? ", " : "", kProfNames[i],
+                (unsigned long long)g_prof_counts[i].load(memory_order_relaxed));
+    fprintf(f, ", \"spans_dropped\": %llu}}\n]}\n", (unsigned long long)g_spans_dropped);
+    return fclose(f) == 0;
+}
+
+void prof_report() {
+    cerr << "Profile:";
+    for (int i = 0; i < (int)Prof::Count; i++)
+        cerr << " " << kProfNames[i] << "=" << g_prof_counts[i].load(memory_order_relaxed);
+    lock_guard<mutex> lk(g_span_mu);
+    cerr << " (" << g_spans.size() << " spans";
+    if (g_spans_dropped) cerr << ", " << g_spans_dropped << " dropped";
+    cerr << ")" << endl;
+}
+
+// ============================================================
+// Problem file reader (mmap + streaming JSON)
+// ============================================================
+
+// Producer map, consumer CSR (counting sort by tensor) and graph I/O flags,
+// from the tensors and the op CSR rows
+void derive_problem(Problem& p) {
+    int nt = (int)p.tensors.size(), no = (int)p.ops.size();
+    p.producer.assign(nt, -1);
+    p.cons_off.assign(nt + 1, 0);
+    for (int i = 0; i < no; i++) {
+        for (int t : p.outs(i)) p.producer[t] = i;
+        for (int t : p.ins(i)) p.cons_off[t + 1]++;
+    }
+    for (int t = 0; t < nt; t++) p.cons_off[t + 1] += p.cons_off[t];
+    p.cons_idx.resize(p.cons_off[nt]);
+    vector<int> fill_pos(p.cons_off.begin(), p.cons_off.end() - 1);
+    for (int i = 0; i < no; i++)
+        for (int t : p.ins(i)) p.cons_idx[fill_pos[t]++] = i;
+    p.is_graph_in.assign(nt, 0);
+    p.is_graph_out.assign(nt, 0);
+    for (int i = 0; i < nt; i++) {
+        if (p.producer[i] < 0) p.is_graph_in[i] = 1;
+        if (p.consumers(i).empty()) p.is_graph_out[i] = 1;
+    }
+}
+
+// Any error of the readers below; thrown deep inside a parse and turned
+// into the message of try_read_problem / try_read_solution at the top.
+struct ReadError {
+    string msg;
+};
+
+// Read-only mapping of a whole file; empty files map to an empty range
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const char* path) {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) close(fd);
+            throw ReadError{string("Cannot open ") + path};
+        }
+        size = (size_t)st.st_size;
+        if (size > 0) {
+            void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED) {
+                close(fd);
+                throw ReadError{string("Cannot map ") + path};
+            }
+            madvise(m, size, MADV_SEQUENTIAL);
+            data = (const char*)m;
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (data) munmap((void*)data, size);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Pull-style JSON reader over a byte range: the caller walks the document,
+// and values are handed out as integers or views into the buffer. Strings
+// are taken verbatim (the input format has no escapes). Malformed input
+// throws a ReadError with the byte offset.
+struct JsonCursor {
+    const char* p;
+    const char* begin;
+    const char* end;
+    const char* path;
+
+    JsonCursor(const char* b, size_t n, const char* file) : p(b), begin(b), end(b + n), path(file) {}
+
+    [[noreturn]] void fail(const char* what) const {
+        throw ReadError{string(path) + ": " + what + " at byte " + to_string(p - begin)};
+    }
+    char peek() {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+        return p < end ? *p : '\0';
+    }
+    void expect(char c) {
+        if (peek() != c) fail(c == ':' ? "expected ':'" : "unexpected character");
+        p++;
+    }
+    string_view str() {
+        expect('"');
+        const char* s = p;
+        while (p < end && *p != '"') p += *p == '\\' ? 2 : 1;
+        if (p >= end) fail("unterminated string");
+        return {s, (size_t)(p++ - s)};
+    }
+    // Integers parse exactly; a fraction or exponent is accepted only when
+    // the value is still a whole number (2.0, 1e3)
+    int64_t i64() {
+        peek();
+        int64_t v = 0;
+        auto [q, ec] = from_chars(p, end, v);
+        if (ec == errc() && (q == end || (*q != '.' && *q != 'e' && *q != 'E'))) {
+            p = q;
+            return v;
+        }
+        double d = 0;
+        auto [r, ec2] = from_chars(p, end, d);
+        if (ec2 != errc()) fail("expected a number");
+        if (d != std::floor(d) || std::fabs(d) >= 9.2e18) fail("expected an integer");
+        p = r;
+        return (int64_t)d;
+    }
+    double num() {
+        peek();
+        double d = 0;
+        auto [q, ec] = from_chars(p, end, d);
+        if (ec != errc()) fail("expected a number");
+        p = q;
+        return d;
+    }
+    // Consumes a null literal if one is next
+    bool null() {
+        if (peek() != 'n') return false;
+        if (end - p < 4 || string_view(p, 4) != "null") fail("unexpected character");
+        p += 4;
+        return true;
+    }
+    // Calls f() once per element, with the cursor on the element
+    template <class F> void array(F f) {
+        expect('[');
+        if (peek() == ']') { p++; return; }
+        for (;;) {
+            f();
+            char c = peek();
+            p++;
+            if (c == ']') return;
+            if (c != ',') fail("expected ',' or ']'");
+        }
+    }
+    // Calls f(key) once per member, with the cursor on the value
+    template <class F> void object(F f) {
+        expect('{');
+        if (peek() == '}') { p++; return; }
+        for (;;) {
+            string_view key = str();
+            expect(':');
+            f(key);
+            char c = peek();
+            p++;
+            if (c == '}') return;
+            if (c != ',') fail("expected ',' or '}'");
+        }
+    }
+    void skip() {
+        char c = peek();
+        if (c == '{') object([&](string_view) { skip(); });
+        else if (c == '[') array([&] { skip(); });
+        else if (c == '"') str();
+        else if (c == 'n' || c == 't' || c == 'f') {
+            while (p < end && isalpha((unsigned char)*p)) p++;
+        } else num();
+    }
+};
+
+// Single pass over the mapped file straight into the Problem arrays: op
+// rows go into the CSR as they are read, and keys may come in any order.
+static Problem parse_problem(const char* path) {
+    MappedFile file(path);
+    JsonCursor j(file.data, file.size, path);
+    Problem p;
+    vector<int64_t> heights;
+    vector<uint8_t> matmul;
+    p.in_off.assign(1, 0);
+    p.out_off.assign(1, 0);
+    p.fast_cap = p.slow_bw = p.nat_w = p.nat_h = 0;
+    auto csr_rows = [&](vector<int>& off, vector<int>& idx) {
+        j.array([&] {
+            j.array([&] { idx.push_back((int)j.i64()); });
+            off.push_back((int)idx.size());
+        });
+    };
+    j.object([&](string_view key) {
+        if (key == "widths") j.array([&] { p.tensors.push_back({j.i64(), 0}); });
+        else if (key == "heights") j.array([&] { heights.push_back(j.i64()); });
+        else if (key == "inputs") csr_rows(p.in_off, p.in_idx);
+        else if (key == "outputs") csr_rows(p.out_off, p.out_idx);
+        else if (key == "op_types") j.array([&] { matmul.push_back(j.str() == "MatMul"); });
+        else if (key == "base_costs") j.array([&] { p.ops.push_back({OpKind::Pointwise, j.i64(), 0}); });
+        else if (key == "fast_memory_capacity") p.fast_cap = j.i64();
+        else if (key == "slow_memory_bandwidth") p.slow_bw = j.i64();
+        else if (key == "native_granularity") {
+            int i = 0;
+            j.array([&] { (i++ == 0 ? p.nat_w : p.nat_h) = j.i64(); });
+        } else j.skip();
+    });
+
+    int nt = (int)p.tensors.size(), no = (int)p.in_off.size() - 1;
+    auto fail = [&](const string& what) { throw ReadError{string(path) + ": " + what}; };
+    if ((int)heights.size() != nt || (int)p.out_off.size() - 1 != no ||
+        (int)matmul.size() != no || (int)p.ops.size() != no)
+        fail("array lengths disagree");
+    for (int t = 0; t < nt; t++) p.tensors[t].h = heights[t];
+    for (int t : p.in_idx)
+        if (t < 0 || t >= nt) fail("tensor id " + to_string(t) + " out of range");
+    for (int t : p.out_idx)
+        if (t < 0 || t >= nt) fail("tensor id " + to_string(t) + " out of range");
+    for (int i = 0; i < no; i++) {
+        Op& op = p.ops[i];
+        if (!matmul[i]) continue;
+        if (p.ins(i).empty()) fail("MatMul op " + to_string(i) + " has no inputs");
+        op.kind = OpKind::MatMul;
+        op.K = p.tensors[p.in_idx[p.in_off[i]]].w;
+    }
+    derive_problem(p);
+    return p;
+}
+
+bool try_read_problem(const char* path, Problem& p, string& err) {
+    try {
+        p = parse_problem(path);
+        return true;
+    } catch (const ReadError& e) {
+        err = e.msg;
+        return false;
+    }
+}
+
+Problem read_problem(const char* path) {
+    Problem p;
+    string err;
+    if (!try_read_problem(path, p, err)) { cerr << err << endl; exit(1); }
+    return p;
+}
+
+// ============================================================
+// Solution file reader
+// ============================================================
+
+static vector<SolutionSubgraph> parse_solution(const char* path) {
+    MappedFile file(path);
+    JsonCursor j(file.data, file.size, path);
+    vector<SolutionSubgraph> sgs;
+    size_t n_gran = 0, n_retain = 0, n_trav = 0, n_lat = 0;
+    // Array of per-subgraph values; grows sgs so keys may come in any order
+    auto rows = [&](size_t& n, auto&& f) {
+        j.array([&] {
+            if (n == sgs.size()) sgs.emplace_back();
+            f(sgs[n++]);
+        });
+    };
+    auto ids = [&](vector<int>& out) { j.array([&] { out.push_back((int)j.i64()); }); };
+    size_t n_ops = 0;
+    j.object([&](string_view key) {
+        if (key == "subgraphs") rows(n_ops, [&](SolutionSubgraph& sg) { ids(sg.ops); });
+        else if (key == "granularities")
+            rows(n_gran, [&](SolutionSubgraph& sg) {
+                int i = 0;
+                j.array([&] {
+                    int64_t v = j.i64();
+                    if (i < 3) (i == 0 ? sg.gran.w : i == 1 ? sg.gran.h : sg.gran.k) = v;
+                    i++;
+                });
+            });
+        else if (key == "tensors_to_retain")
+            rows(n_retain, [&](SolutionSubgraph& sg) {
+                if (!j.null()) ids(sg.retain);
+            });
+        else if (key == "traversal_orders")
+            rows(n_trav, [&](SolutionSubgraph& sg) {
+                if (!j.null()) ids(sg.traversal);
+            });
+        else if (key == "subgraph_latencies") rows(n_lat, [&](SolutionSubgraph& sg) { sg.latency = j.num(); });
+        else j.skip();
+    });
+    size_t n = sgs.size();
+    if (n_ops != n || n_gran != n || n_lat != n || (n_retain && n_retain != n) ||
+        (n_trav && n_trav != n))
+        throw ReadError{string(path) + ": per-subgraph arrays disagree in length"};
+    return sgs;
+}
+
+bool try_read_solution(const char* path, vector<SolutionSubgraph>& sgs, string& err) {
+    try {
+        sgs = parse_solution(path);
+        return true;
+    } catch (const ReadError& e) {
+        err = e.msg;
+        return false;
+    }
+}
+
+vector<SolutionSubgraph> read_solution(const char* path) {
+    vector<SolutionSubgraph> sgs;
+    string err;
+    if (!try_read_solution(path, sgs, err)) { cerr << err << endl; exit(1); }
+    return sgs;
+}
+
+// ============================================================
+// Subgraph analysis
+// ============================================================
+
+// Per-thread epoch-stamped marks so analyze needs no per-call sets. Sized
+// on first use; after that analyze only reuses capacity in `info`.
+struct AnalyzeScratch {
+    vector<uint32_t> op_mark, prod_mark, in_mark;
+    vector<int> slot;
+    uint32_t epoch = 0;
+
+    uint32_t next(const Problem& p) {
+        if (op_mark.size() < p.ops.size()) op_mark.assign(p.ops.size(), 0);
+        if (prod_mark.size() < p.tensors.size()) {
+            prod_mark.assign(p.tensors.size(), 0);
+            in_mark.assign(p.tensors.size(), 0);
+            slot.assign(p.tensors.size(), 0);
+        }
+        if (++epoch == 0) {  // wrapped: clear stale stamps
+            fill(op_mark.begin(), op_mark.end(), 0);
+            fill(prod_mark.begin(), prod_mark.end(), 0);
+            fill(in_mark.begin(), in_mark.end(), 0);
+            epoch = 1;
+        }
+        return epoch;
+    }
+};
+
+void analyze(const Problem& p, const vector<int>& ops, SGInfo& info) {
+    prof_count(Prof::Analyze);
+    static thread_local AnalyzeScratch sc;
+    uint32_t ep = sc.next(p);
+    info.in_bd.clear();
+    info.out_bd.clear();
+    info.ephem.clear();
+    info.out_W = info.out_H = 0;
+    info.compute = 0;
+    info.maxK = 0;
+
+    for (int oi : ops) {
+        sc.op_mark[oi] = ep;
+        for (int t : p.outs(oi)) sc.prod_mark[t] = ep;
+    }
+    for (int oi : ops) {
+        const Op& op = p.ops[oi];
+        info.compute += op.base_cost;
+        if (op.kind == OpKind::MatMul) info.maxK = max(info.maxK, op.K);
+        IdSpan ins = p.ins(oi);
+        bool chained = false;  // output feeds a MatMul's LHS in the subgraph
+        if (op.kind == OpKind::MatMul)
+            for (int t : p.outs(oi))
+                for (int c : p.consumers(t))
+                    if (sc.op_mark[c] == ep && p.ops[c].kind == OpKind::MatMul &&
+                        p.ins(c)[0] == t)
+                        chained = true;
+        for (int j = 0; j < ins.size(); j++) {
+            int t = ins[j];
+            if (sc.prod_mark[t] == ep) continue;
+            if (sc.in_mark[t] != ep) {
+                sc.in_mark[t] = ep;
+                sc.slot[t] = (int)info.in_bd.size();
+                info.in_bd.push_back({t, 0, 0, 0});
+            }
+            InBd& b = info.in_bd[sc.slot[t]];
+            if (op.kind == OpKind::MatMul) {
+                if (j == 0) {
+                    b.roles |= chained ? ROLE_LHS | ROLE_CHAIN : ROLE_LHS;
+                    b.K_lhs = max(b.K_lhs, op.K);
+                }
+                else        { b.roles |= ROLE_RHS; b.K_rhs = max(b.K_rhs, op.K); }
+            } else {
+                b.roles |= ROLE_PW;
+            }
+        }
+        for (int t : p.outs(oi)) {
+            info.out_W = max(info.out_W, p.tensors[t].w);
+            info.out_H = max(info.out_H, p.tensors[t].h);
+            bool external = p.is_graph_out[t];
+            if (!external)
+                for (int c : p.consumers(t))
+                    if (sc.op_mark[c] != ep) { external = true; break; }
+            if (external)
+                info.out_bd.push_back(t);
+            else
+                info.ephem.push_back(t);
+        }
+    }
+    sort(info.in_bd.begin(), info.in_bd.end(),
+         [](const InBd& a, const InBd& b) { return a.t < b.t; });
+    sort(info.out_bd.begin(), info.out_bd.end());
+    sort(info.ephem.begin(), info.ephem.end());
+}
+
+SGInfo analyze(const Problem& p, const vector<int>& ops) {
+    SGInfo info;
+    analyze(p, ops, info);
+    return info;
+}
+
+// The full tensor less its input slice or output tile. Never negative: a
+// tile larger than the tensor frees nothing.
+int64_t resident_extra(const Problem& p, const SGInfo& info, const Gran& g, int t) {
+    int64_t full = p.tensors[t].w * p.tensors[t].h;
+    if (const InBd* b = find_in_bd(info, t)) return max((int64_t)0, full - input_slice(*b, g));
+    if (find(info.out_bd.begin(), info.out_bd.end(), t) != info.out_bd.end())
+        return max((int64_t)0, full - g.w * g.h);
+    return full;
+}
+
+int64_t resident_bytes(const Problem& p, const SGInfo& info, const Gran& g,
+                       const vector<int>& held, const vector<int>& keep) {
+    int64_t used = 0;
+    for (int t : held) used += resident_extra(p, info, g, t);
+    for (int t : keep)
+        if (find(held.begin(), held.end(), t) == held.end())
+            used += resident_extra(p, info, g, t);
+    return used;
+}
+
+ScheduleCtx schedule_ctx(const Problem& p, const vector<SGInfo>& raw) {
+    ScheduleCtx ctx;
+    ctx.readers.assign(p.tensors.size(), 0);
+    ctx.first_prod.assign(p.tensors.size(), INT_MAX);
+    for (int q = 0; q < (int)raw.size(); q++) {
+        for (const InBd& b : raw[q].in_bd) ctx.readers[b.t]++;
+        for (int t : raw[q].out_bd) ctx.first_prod[t] = min(ctx.first_prod[t], q);
+        for (int t : raw[q].ephem) ctx.first_prod[t] = min(ctx.first_prod[t], q);
+    }
+    return ctx;
+}
+
+SGInfo in_context(const Problem& p, const SGInfo& raw, int q, const ScheduleCtx& ctx) {
+    SGInfo info = raw;
+    info.out_bd.clear();
+    info.ephem.clear();
+    auto place = [&](int t) {
+        bool wb = ctx.first_prod[t] == q && (p.is_graph_out[t] || ctx.readers[t] > 0);
+        (wb ? info.out_bd : info.ephem).push_back(t);
+    };
+    for (int t : raw.out_bd) place(t);
+    for (int t : raw.ephem) place(t);
+    sort(info.out_bd.begin(), info.out_bd.end());
+    sort(info.ephem.begin(), info.ephem.end());
+    return info;
+}
+
+// ============================================================
+// Schedule simulator (reference evaluator)
+// ============================================================
+
+namespace {
+
+// One position of the schedule, walked tile by tile. A MatMul input used
+// only as LHS (RHS) is cached per tile row (column) as a full-K strip. Each
+// such input keeps its current strip; under StripCache::Lru further strips
+// live in an LRU over the `spare` room run() is given. Everything
+// else is loaded on every tile.
+//
+// Under SimModel::Step a tile runs as ceil(K/k) k-steps: pointwise inputs
+// arrive in the first step and outputs leave in the last. A strip streams
+// in h×k / k×w pieces unless it is pinned: then it arrives whole in the
+// first step and stays while the walk keeps to its row (column), in any
+// order. Pins are not in the output format, so run() tries the pin sets
+// StepModel tries (ROLE_CHAIN inputs always pinned, every subset of the 5
+// cheapest others that fits in `spare`) and keeps the cheapest walk.
+struct PositionWalk {
+    struct Strip {
+        int role;       // 1 = LHS (per row), 2 = RHS (per column)
+        int64_t K;      // reduction depth it is streamed over
+        int64_t bytes;  // full-K strip
+        int base;       // first LRU node
+        int64_t pin;    // extra fast memory pinning it takes over its slice
+        bool chain;     // ROLE_CHAIN: always pinned
+    };
+    static constexpr int kMaxPinCands = 5;
+
+    const Problem& p;
+    const SGInfo& info;
+    Gran g;
+    SimModel model;
+    int64_t tiles_x, tiles_y, steps;
+    double compute = 0, fixed = 0, out = 0;  // per tile, bytes for the last two
+    vector<Strip> strips;
+
+    PositionWalk(const Problem& prob, const SGInfo& si, const Gran& gr, SimModel m,
+                 const vector<int>& held, const vector<int>& keep)
+        : p(prob), info(si), g(gr), model(m) {
+        tiles_x = (info.out_W + g.w - 1) / g.w;
+        tiles_y = (info.out_H + g.h - 1) / g.h;
+        steps = model == SimModel::Step && info.maxK > 0 ? (info.maxK + g.k - 1) / g.k : 1;
+        int64_t nat_scale = max((int64_t)1, (g.w + p.nat_w - 1) / p.nat_w) *
+                            max((int64_t)1, (g.h + p.nat_h - 1) / p.nat_h);
+        compute = (double)info.compute * nat_scale;
+        for (const InBd& b : info.in_bd) {
+            if (binary_search(held.begin(), held.end(), b.t)) continue;  // already resident
+            int role = reuse_role(b);
+            if (role == 0) fixed += (double)tile_mem_in(b, g);
+            else
+                strips.push_back({role, role == 1 ? b.K_lhs : b.K_rhs, tile_mem_in(b, g), 0,
+                                  tile_mem_in(b, g) - input_slice(b, g),
+                                  (b.roles & ROLE_CHAIN) != 0});
+        }
+        for (int t : info.out_bd)
+            if (!binary_search(keep.begin(), keep.end(), t)) out += (double)(g.w * g.h);
+    }
+
+    // Bytes strip input s streams in k-step `step` (all of it in one step)
+    double piece(const Strip& s, int64_t step) const {
+        if (steps == 1) return (double)s.bytes;
+        if (step * g.k >= s.K) return 0;
+        return (double)(s.role == 1 ? g.h : g.w) * min(g.k, s.K - step * g.k);
+    }
+
+    // Step-model latency over `order` with strips[i] pinned for each bit i
+    // of `pins`
+    double walk_pinned(const vector<int>& order, uint32_t pins) const {
+        vector<double> streamed(steps, 0);
+        for (size_t i = 0; i < strips.size(); i++)
+            if (!(pins >> i & 1))
+                for (int64_t s = 0; s < steps; s++) streamed[s] += piece(strips[i], s);
+        double total = 0;
+        int64_t px = -1, py = -1;
+        for (int tile : order) {
+            int64_t tx = tile % tiles_x, ty = tile / tiles_x;
+            double first = fixed;
+            for (size_t i = 0; i < strips.size(); i++)
+                if ((pins >> i & 1) && (strips[i].role == 1 ? ty != py : tx != px))
+                    first += (double)strips[i].bytes;
+            for (int64_t s = 0; s < steps; s++) {
+                double m = streamed[s];
+                if (s == 0) m += first;
+                if (s == steps - 1) m += out;
+                total += max(compute / steps, m / p.slow_bw);
+            }
+            px = tx;
+            py = ty;
+        }
+        return total;
+    }
+
+    // Cheapest walk over the pin sets StepModel::best_pins tries; `extra`
+    // gets what its pins take beyond their slices
+    double run_step(const vector<int>& order, int64_t spare, int64_t& extra) const {
+        uint32_t forced = 0;
+        vector<int> cands;
+        for (int i = 0; i < (int)strips.size() && i < 32; i++) {
+            if (strips[i].chain) forced |= 1u << i;
+            else if (strips[i].pin <= spare) cands.push_back(i);
+        }
+        sort(cands.begin(), cands.end(), [&](int a, int b) {
+            return make_pair(strips[a].pin, a) < make_pair(strips[b].pin, b);
+        });
+        if ((int)cands.size() > kMaxPinCands) cands.resize(kMaxPinCands);
+        double best = walk_pinned(order, forced);
+        extra = 0;
+        for (uint32_t m = 1; m < (1u << cands.size()); m++) {
+            int64_t used = 0;
+            uint32_t pins = forced;
+            for (size_t j = 0; j < cands.size(); j++)
+                if (m >> j & 1) {
+                    used += strips[cands[j]].pin;
+                    pins |= 1u << cands[j];
+                }
+            if (used > spare) continue;
+            double lat = walk_pinned(order, pins);
+            if (lat < best) {
+                best = lat;
+                extra = used;
+            }
+        }
+        return best;
+    }
+
+    // Latency over `order`; `extra` gets the most fast memory cached strips
+    // took beyond one per input. Without `reuse` every tile reloads all its
+    // inputs.
+    double run(const vector<int>& order, bool reuse, int64_t spare, int64_t& extra) {
+        if (model == SimModel::Step) return run_step(order, spare, extra);
+        extra = 0;
+        bool cache = reuse;
+        int nodes = 0;
+        int64_t current = 0;  // one strip per input, always kept
+        for (Strip& s : strips) {
+            s.base = nodes;
+            nodes += (int)(s.role == 1 ? tiles_y : tiles_x);
+            current += s.bytes;
+        }
+        int64_t cap = max((int64_t)0, spare) + current, used = 0;
+        vector<int64_t> stamp(cache ? nodes : 0, -1);  // -1: not resident
+        set<pair<int64_t, int>> lru;                   // (last use, node)
+        vector<int> owner(cache ? nodes : 0);
+        for (int i = 0; cache && i < (int)strips.size(); i++)
+            for (int n = 0; n < (int)(strips[i].role == 1 ? tiles_y : tiles_x); n++)
+                owner[strips[i].base + n] = i;
+
+        double total = 0;
+        int64_t clock = 0;
+        for (int tile : order) {
+            int64_t tx = tile % tiles_x, ty = tile / tiles_x;
+            if (!cache) {
+                double m = fixed + out;
+                for (const Strip& st : strips) m += (double)st.bytes;
+                total += max(compute, m / p.slow_bw);
+                continue;
+            }
+            double m = fixed + out;
+            for (const Strip& st : strips) {
+                int n = st.base + (int)(st.role == 1 ? ty : tx);
+                if (stamp[n] >= 0) {
+                    lru.erase({stamp[n], n});
+                } else {
+                    m += (double)st.bytes;
+                    used += st.bytes;
+                }
+                stamp[n] = clock++;
+                lru.insert({stamp[n], n});
+            }
+            while (used > cap) {
+                int n = lru.begin()->second;
+                lru.erase(lru.begin());
+                stamp[n] = -1;
+                used -= strips[owner[n]].bytes;
+            }
+            extra = max(extra, used - current);
+            total += max(compute, m / p.slow_bw);
+        }
+        return total;
+    }
+};
+
+// Valid retained ids, sorted and unique
+vector<int> retained_ids(const Problem& p, const vector<int>& retain) {
+    vector<int> ids;
+    for (int t : retain)
+        if (t >= 0 && t < (int)p.tensors.size()) ids.push_back(t);
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+}  // namespace
+
+vector<SGInfo> solution_infos(const Problem& p, const vector<SolutionSubgraph>& sgs) {
+    int ns = (int)sgs.size();
+    vector<SGInfo> infos(ns);
+    for (int q = 0; q < ns; q++) {
+        vector<int> ops = sgs[q].ops;
+        sort(ops.begin(), ops.end());
+        ops.erase(unique(ops.begin(), ops.end()), ops.end());
+        analyze(p, ops, infos[q]);
+    }
+    ScheduleCtx ctx = schedule_ctx(p, infos);
+    for (int q = 0; q < ns; q++) infos[q] = in_context(p, infos[q], q, ctx);
+    return infos;
+}
+
+SimResult simulate(const Problem& p, const vector<SolutionSubgraph>& sgs, SimModel model,
+                   StripCache cache) {
+    int ns = (int)sgs.size();
+    vector<SGInfo> infos = solution_infos(p, sgs);
+
+    SimResult r;
+    r.lats.assign(ns, 0);
+    r.peak.assign(ns, 0);
+    vector<int> held;
+    for (int q = 0; q < ns; q++) {
+        const SGInfo& info = infos[q];
+        const Gran& g = sgs[q].gran;
+        vector<int> keep = retained_ids(p, sgs[q].retain);
+        int64_t base = working_set(info, g) + resident_bytes(p, info, g, held, keep);
+        r.peak[q] = base;
+        if (info.out_W > 0 && info.out_H > 0 && g.w > 0 && g.h > 0 && g.k > 0) {
+            int64_t ntiles = ((info.out_W + g.w - 1) / g.w) * ((info.out_H + g.h - 1) / g.h);
+            vector<int> order = sgs[q].traversal;
+            vector<uint8_t> seen(ntiles, 0);
+            bool perm = (int64_t)order.size() == ntiles;
+            for (int i = 0; perm && i < (int)order.size(); i++) {
+                int t = order[i];
+                perm = t >= 0 && t < ntiles && !seen[t];
+                if (perm) seen[t] = 1;
+            }
+            bool reuse = perm && !is_raster(order);
+            if (!perm) {
+                if (!order.empty()) r.bad_traversal.push_back(q);
+                order.resize(ntiles);
+                for (int i = 0; i < (int)ntiles; i++) order[i] = i;
+            }
+            PositionWalk walk(p, info, g, model, held, keep);
+            int64_t extra = 0;
+            int64_t spare =
+                cache == StripCache::Lru || model == SimModel::Step ? p.fast_cap - base : 0;
+            r.lats[q] = walk.run(order, reuse, spare, extra);
+            r.peak[q] = base + extra;
+        }
+        held = move(keep);
+    }
+    return r;
+}
@@ -0,0 +1,311 @@
+// mlsys_core.h — problem model, file readers and cost kernels shared by
+// mlsys (solver.cpp) and verify (verify.cpp); built as libmlsys_core.a.
+
+#ifndef MLSYS_CORE_H_
+#define MLSYS_CORE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ============================================================
+// Profiling (mlsys --profile)
+// ============================================================
+
+// Hot-path call counters and scoped phase timers, written out as a Chrome
+// trace-event file. Off unless prof_enable() ran; every hook is then a
+// single not-taken branch on g_profile.
+enum class Prof {
+    FindBestGran,   // find_best_gran calls
+    Analyze,        // analyze calls
+    CycleQuery,     // merge cycle checks (reachability index or BFS)
+    CreatesCycle,   // BFS cycle checks (creates_cycle)
+    CalcLatency,    // calc_latency calls
+    GranTried,      // granularity candidates scored
+    GranCapReject,  // granularity candidates rejected by fast_memory_capacity
+    Count
+};
+
+extern bool g_profile;
+extern std::atomic<uint64_t> g_prof_counts[(int)Prof::Count];
+
+inline void prof_count(Prof c, uint64_t n = 1) {
+    if (__builtin_expect(g_profile, 0))
+        g_prof_counts[(int)c].fetch_add(n, std::memory_order_relaxed);
+}
+
+void prof_enable();
+int64_t prof_now_us();  // since prof_enable()
+// Records a completed span on the calling thread. Thread-safe.
+void prof_span(const char* name, int64_t start_us, int64_t dur_us);
+// Writes every span plus the final counters; false if the file can't be written.
+bool prof_write_trace(const char* path);
+// One line of counters for the log
+void prof_report();
+
+// Times its enclosing scope as a span named `name` (a string literal)
+struct ProfScope {
+    const char* name;
+    int64_t t0 = -1;
+    explicit ProfScope(const char* n) : name(n) {
+        if (__builtin_expect(g_profile, 0)) t0 = prof_now_us();
+    }
+    ~ProfScope() {
+        if (__builtin_expect(t0 >= 0, 0)) prof_span(name, t0, prof_now_us() - t0);
+    }
+    ProfScope(const ProfScope&) = delete;
+    ProfScope& operator=(const ProfScope&) = delete;
+};
+
+// ============================================================
+// Problem data structures
+// ============================================================
+
+struct Tensor {
+    int64_t w, h;
+};
+
+enum class OpKind : uint8_t { Pointwise, MatMul };
+
+struct Op {
+    OpKind kind;
+    int64_t base_cost;
+    int64_t K;  // reduction dim for MatMul (= LHS width), 0 for Pointwise
+};
+
+// Read-only view of one CSR row
+struct IdSpan {
+    const int* b;
+    const int* e;
+    const int* begin() const { return b; }
+    const int* end() const { return e; }
+    int size() const { return (int)(e - b); }
+    bool empty() const { return b == e; }
+    int operator[](int i) const { return b[i]; }
+};
+
+struct Problem {
+    std::vector<Tensor> tensors;
+    std::vector<Op> ops;
+    int64_t fast_cap, slow_bw, nat_w, nat_h;
+    // CSR adjacency: op -> input/output tensors, tensor -> consuming ops
+    std::vector<int> in_off, in_idx;
+    std::vector<int> out_off, out_idx;
+    std::vector<int> cons_off, cons_idx;
+    std::vector<int> producer;  // producer[t] = op producing tensor t, -1 if graph input
+    std::vector<uint8_t> is_graph_in, is_graph_out;
+
+    IdSpan ins(int oi) const { return {in_idx.data() + in_off[oi], in_idx.data() + in_off[oi + 1]}; }
+    IdSpan outs(int oi) const { return {out_idx.data() + out_off[oi], out_idx.data() + out_off[oi + 1]}; }
+    IdSpan consumers(int t) const {
+        return {cons_idx.data() + cons_off[t], cons_idx.data() + cons_off[t + 1]};
+    }
+};
+
+// Producer map, consumer CSR and graph I/O flags, from the tensors and the
+// op CSR rows
+void derive_problem(Problem& p);
+
+// Maps the file and fills the Problem in one pass. On I/O or format errors
+// try_read_problem returns false with the message in `err`; read_problem
+// prints it and exits.
+bool try_read_problem(const char* path, Problem& p, std::string& err);
+Problem read_problem(const char* path);
+
+// ============================================================
+// Granularity & subgraph analysis
+// ============================================================
+
+struct Gran {
+    int64_t w, h, k;
+};
+
+// Roles a boundary input plays across the subgraph's consuming ops.
+// ROLE_CHAIN marks the LHS of a MatMul whose output is the LHS of another
+// MatMul in the subgraph. The k-steps then split the outer reduction, so
+// every step needs the inner LHS over its whole K, as in PROBLEM.md
+// Example 5.
+enum : uint8_t { ROLE_LHS = 1, ROLE_RHS = 2, ROLE_PW = 4, ROLE_CHAIN = 8 };
+
+struct InBd {
+    int t;
+    uint8_t roles;
+    int64_t K_lhs, K_rhs;  // max reduction depth over LHS / RHS uses
+};
+
+struct SGInfo {
+    std::vector<InBd> in_bd;  // input boundary tensors (need to load), sorted by id
+    std::vector<int> out_bd;  // output boundary tensors (need to evict), sorted
+    std::vector<int> ephem;   // ephemeral (internal) tensors, sorted
+    int64_t out_W, out_H;  // max output tensor dims (for spatial tiling)
+    int64_t compute;       // Σ base_cost over ops
+    int64_t maxK;          // max K across MatMuls (0 if no MatMuls)
+};
+
+// Instantaneous slice size of a boundary INPUT tensor (for working-set check)
+// Takes the max across all consuming ops in the subgraph.
+inline int64_t input_slice(const InBd& b, const Gran& g) {
+    int64_t s = 0;
+    if (b.roles & ROLE_LHS) s = std::max(s, g.h * (b.roles & ROLE_CHAIN ? b.K_lhs : g.k));
+    if (b.roles & ROLE_RHS) s = std::max(s, g.w * g.k);
+    if (b.roles & ROLE_PW) s = std::max(s, g.w * g.h);
+    return s;
+}
+
+// Total memory transferred for a boundary INPUT tensor per spatial tile
+// (uses K_full for MatMul; takes max across consuming ops)
+inline int64_t tile_mem_in(const InBd& b, const Gran& g) {
+    int64_t s = 0;
+    if (b.roles & ROLE_LHS) s = std::max(s, g.h * b.K_lhs);
+    if (b.roles & ROLE_RHS) s = std::max(s, g.w * b.K_rhs);
+    if (b.roles & ROLE_PW) s = std::max(s, g.w * g.h);
+    return s;
+}
+
+// Reuse class for zig-zag traversal, from MatMul uses only:
+// 1=LHS only, 2=RHS only, 0=other
+inline int reuse_role(const InBd& b) {
+    uint8_t mm = b.roles & (ROLE_LHS | ROLE_RHS);
+    return mm == ROLE_LHS ? 1 : mm == ROLE_RHS ? 2 : 0;
+}
+
+// How MatMul strips are charged between tiles of one subgraph.
+// Adjacent (PROBLEM.md): a tile reuses only the strips it shares with the
+// tile before it. Lru: fast memory left over after the working set and the
+// resident tensors also caches older strips, least recently used out first.
+enum class StripCache { Adjacent, Lru };
+
+// True if `order` is the raster order 0, 1, 2, ... PROBLEM.md Example 4A
+// charges raster with every input reloaded on every tile, so it gets no
+// strip reuse whether it is written out or left null.
+inline bool is_raster(const std::vector<int>& order) {
+    for (int i = 0; i < (int)order.size(); i++)
+        if (order[i] != i) return false;
+    return true;
+}
+
+inline const InBd* find_in_bd(const SGInfo& info, int t) {
+    auto it = std::lower_bound(info.in_bd.begin(), info.in_bd.end(), t,
+                          [](const InBd& b, int x) { return b.t < x; });
+    return (it != info.in_bd.end() && it->t == t) ? &*it : nullptr;
+}
+
+// Boundary inputs/outputs, ephemerals and compute of an op set. Reuses the
+// capacity already in `info`; not allocating in steady state.
+void analyze(const Problem& p, const std::vector<int>& ops, SGInfo& info);
+SGInfo analyze(const Problem& p, const std::vector<int>& ops);
+
+// Working set per tile (must fit in fast_cap)
+inline int64_t working_set(const SGInfo& info, const Gran& g) {
+    int64_t ws = 0;
+    for (const InBd& b : info.in_bd) ws += input_slice(b, g);
+    ws += (int64_t)info.out_bd.size() * (g.w * g.h);
+    return ws;
+}
+
+// Fast memory a resident tensor takes during a subgraph beyond the slice
+// its working set already counts (the full tensor if it touches neither)
+int64_t resident_extra(const Problem& p, const SGInfo& info, const Gran& g, int t);
+
+// Resident bytes held through a subgraph: what it received (held) plus what
+// it keeps for the next one, each tensor counted once.
+int64_t resident_bytes(const Problem& p, const SGInfo& info, const Gran& g,
+                       const std::vector<int>& held, const std::vector<int>& keep);
+
+// Who produces and who reads each tensor across a schedule. When every op
+// is in exactly one subgraph this just reproduces analyze()'s out_bd. Once
+// an op is recomputed in several subgraphs, only its first copy writes its
+// outputs back, and only if they are graph outputs or some subgraph reads
+// them from slow memory.
+struct ScheduleCtx {
+    std::vector<int> readers;     // # positions with t in in_bd
+    std::vector<int> first_prod;  // first position producing t (INT_MAX = none)
+};
+
+// `raw` is analyze() of each position's ops.
+ScheduleCtx schedule_ctx(const Problem& p, const std::vector<SGInfo>& raw);
+
+// Boundary of position q given the rest of the schedule: the outputs this
+// copy must write back, with everything else it produces ephemeral.
+SGInfo in_context(const Problem& p, const SGInfo& raw, int q, const ScheduleCtx& ctx);
+
+// ============================================================
+// Latency model (per-tile roofline, raster order, no retention)
+// ============================================================
+
+inline double tile_latency(const Problem& p, const SGInfo& info, const Gran& g) {
+    if (info.out_W <= 0 || info.out_H <= 0) return 0;
+    int64_t tiles_x = (info.out_W + g.w - 1) / g.w;
+    int64_t tiles_y = (info.out_H + g.h - 1) / g.h;
+    int64_t ntiles = tiles_x * tiles_y;
+
+    // --- Per spatial tile cost ---
+    // Compute: each op runs once per tile, padded to native
+    int64_t nat_scale = std::max((int64_t)1, (g.w + p.nat_w - 1) / p.nat_w) *
+                        std::max((int64_t)1, (g.h + p.nat_h - 1) / p.nat_h);
+    double compute = (double)info.compute * nat_scale;
+
+    // Memory in: total per-tile transfer (full K for MatMul inputs)
+    double mem_in = 0;
+    for (const InBd& b : info.in_bd)
+        mem_in += (double)tile_mem_in(b, g) / p.slow_bw;
+    // Memory out: boundary output tensor slices / bandwidth
+    double mem_out = 0;
+    for (size_t i = 0; i < info.out_bd.size(); i++)
+        mem_out += (double)(g.w * g.h) / p.slow_bw;
+
+    double tile_lat = std::max(compute, mem_in + mem_out);
+    return ntiles * tile_lat;
+}
+
+// ============================================================
+// Solution files
+// ============================================================
+
+struct SolutionSubgraph {
+    std::vector<int> ops;
+    Gran gran{0, 0, 0};
+    std::vector<int> retain;
+    std::vector<int> traversal;  // empty for a null traversal order
+    double latency = 0;          // as reported in the file
+};
+
+// Parses a solution file in one pass. I/O and format errors, and
+// per-subgraph arrays that disagree in length, fail like read_problem.
+bool try_read_solution(const char* path, std::vector<SolutionSubgraph>& sgs, std::string& err);
+std::vector<SolutionSubgraph> read_solution(const char* path);
+
+// ============================================================
+// Schedule simulator (reference evaluator)
+// ============================================================
+
+// Tile: one roofline per tile, the model the solver reports with.
+// Step: every tile split into ceil(K/k) k-steps, each its own roofline,
+// with strips pinned as StepModel pins them. Strips are then charged by
+// the pins and `cache` is ignored.
+enum class SimModel { Tile, Step };
+
+struct SimResult {
+    std::vector<double> lats;        // per schedule position
+    std::vector<int64_t> peak;       // peak fast-memory occupancy per position
+    std::vector<int> bad_traversal;  // positions whose order is not a tile permutation
+};
+
+// Boundaries of each position of a solution in schedule context (see
+// in_context); duplicate op ids within a subgraph count once.
+std::vector<SGInfo> solution_infos(const Problem& p, const std::vector<SolutionSubgraph>& sgs);
+
+// Walks every subgraph of a solution tile by tile in its traversal order
+// and returns what each position costs. A raster order, null or written
+// out, reloads every input on every tile, as PROBLEM.md Example 4A charges
+// it; so does an order that is not a permutation of the tiles, which is
+// also reported. Other orders reuse MatMul strips as `cache` says. Inputs
+// held from the previous position are free and retained outputs are not
+// written back. Op ids must be valid; retained ids out of range are
+// ignored.
+SimResult simulate(const Problem& p, const std::vector<SolutionSubgraph>& sgs,
+                   SimModel model = SimModel::Tile, StripCache cache = StripCache::Adjacent);
+
+#endif  // MLSYS_CORE_H_
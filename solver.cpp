@@ -1,309 +1,209 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <charconv>
+#include <chrono>
+#include <climits>
 #include <cmath>
+#include <condition_variable>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <queue>
+#include <random>
 #include <set>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-using namespace std;
-
-// ============================================================
-// Minimal JSON parser (handles the specific input format)
-// ============================================================
-
-struct JVal {
-    enum T { NUL, NUM, STR, ARR, OBJ } t = NUL;
-    double n = 0;
-    string s;
-    vector<JVal> a;
-    vector<pair<string, JVal>> o;
-
-    const JVal& operator[](const char* key) const {
-        for (auto& [k, v] : o)
-            if (k == key) return v;
-        static JVal nil;
-        return nil;
-    }
-    const JVal& operator[](size_t i) const { return a[i]; }
-    int sz() const { return t == ARR ? (int)a.size() : (int)o.size(); }
-    int64_t i64() const { return (int64_t)n; }
-};
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-JVal jparse(const string& s, size_t& p) {
-    auto ws = [&] { while (p < s.size() && isspace(s[p])) p++; };
-    ws();
-    if (p >= s.size()) return {};
-    if (s[p] == '{') {
-        JVal v;
-        v.t = JVal::OBJ;
-        p++;
-        ws();
-        while (p < s.size() && s[p] != '}') {
-            auto k = jparse(s, p);
-            ws();
-            if (p < s.size() && s[p] == ':') p++;
-            auto val = jparse(s, p);
-            v.o.push_back({k.s, val});
-            ws();
-            if (p < s.size() && s[p] == ',') p++;
-        }
-        if (p < s.size()) p++;
-        return v;
-    }
-    if (s[p] == '[') {
-        JVal v;
-        v.t = JVal::ARR;
-        p++;
-        ws();
-        while (p < s.size() && s[p] != ']') {
-            v.a.push_back(jparse(s, p));
-            ws();
-            if (p < s.size() && s[p] == ',') p++;
-        }
-        if (p < s.size()) p++;
-        return v;
-    }
-    if (s[p] == '"') {
-        JVal v;
-        v.t = JVal::STR;
-        p++;
-        while (p < s.size() && s[p] != '"') v.s += s[p++];
-        if (p < s.size()) p++;
-        return v;
-    }
-    if (s[p] == 'n') {
-        p += 4;
-        return {};
-    }
-    // number
-    JVal v;
-    v.t = JVal::NUM;
-    size_t start = p;
-    if (s[p] == '-') p++;
-    while (p < s.size() && isdigit(s[p])) p++;
-    if (p < s.size() && s[p] == '.') {
-        p++;
-        while (p < s.size() && isdigit(s[p])) p++;
-    }
-    if (p < s.size() && (s[p] == 'e' || s[p] == 'E')) {
-        p++;
-        if (p < s.size() && (s[p] == '+' || s[p] == '-')) p++;
-        while (p < s.size() && isdigit(s[p])) p++;
-    }
-    v.n = stod(s.substr(start, p - start));
-    return v;
-}
+#include "mlsys_core.h"
 
-JVal jparse(const string& s) {
-    size_t p = 0;
-    return jparse(s, p);
-}
+using namespace std;
 
 // ============================================================
-// Problem data structures
+// Step-level latency engine (per tile × k-step, input pinning)
 // ============================================================
 
-struct Tensor {
-    int64_t w, h;
-};
+// Which latency model drives search and scoring (--model=tile|step)
+enum class LatencyModel { Tile, Step };
+LatencyModel g_model = LatencyModel::Tile;
 
-struct Op {
-    string type;  // "MatMul" or "Pointwise"
-    vector<int> ins, outs;
-    int64_t base_cost;
-};
+// How strips are charged between tiles (--strips=adjacent|lru); verify
+// must be run with the same setting
+StripCache g_strip_cache = StripCache::Adjacent;
 
-struct Problem {
-    vector<Tensor> tensors;
-    vector<Op> ops;
-    int64_t fast_cap, slow_bw, nat_w, nat_h;
-    // derived
-    vector<int> producer;           // producer[t] = op producing tensor t, -1 if graph input
-    vector<vector<int>> consumers;  // consumers[t] = ops consuming tensor t
-    set<int> graph_ins, graph_outs;
-};
+// calc_latency charges a tile as a single max(compute, mem) roofline. That
+// is exact only while every k-step has the same mix of work. This engine
+// walks the k-steps of each tile instead:
+// - a streamed LHS / RHS input brings an h×k / k×w strip per step;
+// - pointwise inputs and pinned inputs arrive in the first step;
+// - outputs leave in the last step;
+// - compute is spread evenly across the steps.
+// A pinned LHS (RHS) input is loaded as its whole h×K (K×w) strip and stays
+// resident while the traversal stays in its row (column). Only the first
+// tile there pays for it, but the full strip must fit in fast memory.
+// Unpinned inputs are streamed again by every tile. A ROLE_CHAIN input is
+// always pinned: PROBLEM.md Example 5 loads it whole in the first step.
+struct StepModel {
+    const Problem& p;
+    const SGInfo& info;
+    Gran g;
+    int64_t steps, tiles_x, tiles_y;
+    double compute_step;
 
-Problem read_problem(const char* path) {
-    ifstream f(path);
-    if (!f) { cerr << "Cannot open " << path << endl; exit(1); }
-    stringstream ss;
-    ss << f.rdbuf();
-    auto j = jparse(ss.str());
+    StepModel(const Problem& prob, const SGInfo& si, const Gran& gr)
+        : p(prob), info(si), g(gr) {
+        steps = info.maxK > 0 ? (info.maxK + g.k - 1) / g.k : 1;
+        tiles_x = (info.out_W + g.w - 1) / g.w;
+        tiles_y = (info.out_H + g.h - 1) / g.h;
+        int64_t nat_scale = max((int64_t)1, (g.w + p.nat_w - 1) / p.nat_w) *
+                            max((int64_t)1, (g.h + p.nat_h - 1) / p.nat_h);
+        compute_step = (double)info.compute * nat_scale / steps;
+    }
 
-    Problem p;
-    int nt = j["widths"].sz();
-    p.tensors.resize(nt);
-    for (int i = 0; i < nt; i++)
-        p.tensors[i] = {j["widths"][(size_t)i].i64(), j["heights"][(size_t)i].i64()};
+    // Extra fast memory a pin needs over streaming the input.
+    int64_t pin_cost(const InBd& b) const { return tile_mem_in(b, g) - input_slice(b, g); }
 
-    int no = j["inputs"].sz();
-    p.ops.resize(no);
-    for (int i = 0; i < no; i++) {
-        p.ops[i].type = j["op_types"][(size_t)i].s;
-        for (int k = 0; k < j["inputs"][(size_t)i].sz(); k++)
-            p.ops[i].ins.push_back((int)j["inputs"][(size_t)i][(size_t)k].i64());
-        for (int k = 0; k < j["outputs"][(size_t)i].sz(); k++)
-            p.ops[i].outs.push_back((int)j["outputs"][(size_t)i][(size_t)k].i64());
-        p.ops[i].base_cost = j["base_costs"][(size_t)i].i64();
-    }
-    p.fast_cap = j["fast_memory_capacity"].i64();
-    p.slow_bw = j["slow_memory_bandwidth"].i64();
-    p.nat_w = j["native_granularity"][(size_t)0].i64();
-    p.nat_h = j["native_granularity"][(size_t)1].i64();
+    // Total latency with in_bd[i] pinned for each bit i of `pins`.
+    double latency(uint32_t pins, bool zigzag, const vector<int>& retained_in,
+                   const vector<int>& retained_out) const {
+        if (info.out_W <= 0 || info.out_H <= 0) return 0;
+        auto retained = [](const vector<int>& v, int t) {
+            return binary_search(v.begin(), v.end(), t);
+        };
 
-    // derived
-    p.producer.assign(nt, -1);
-    p.consumers.resize(nt);
-    for (int i = 0; i < no; i++) {
-        for (int t : p.ops[i].outs) p.producer[t] = i;
-        for (int t : p.ops[i].ins) p.consumers[t].push_back(i);
-    }
-    for (int i = 0; i < nt; i++) {
-        if (p.producer[i] < 0) p.graph_ins.insert(i);
-        if (p.consumers[i].empty()) p.graph_outs.insert(i);
-    }
-    return p;
-}
+        // Per-step stream: (K, bytes per unit of K) for each streamed strip
+        vector<pair<int64_t, int64_t>> streams;
+        double front = 0, pin_l = 0, pin_r = 0, back = 0;
+        for (int i = 0; i < (int)info.in_bd.size(); i++) {
+            const InBd& b = info.in_bd[i];
+            if (retained(retained_in, b.t)) continue;
+            int role = reuse_role(b);
+            if (role != 0 && ((pins >> i & 1) || (b.roles & ROLE_CHAIN)))
+                (role == 1 ? pin_l : pin_r) += (double)tile_mem_in(b, g);
+            else if (role == 1) streams.push_back({b.K_lhs, g.h});
+            else if (role == 2) streams.push_back({b.K_rhs, g.w});
+            else front += (double)tile_mem_in(b, g);
+        }
+        for (int t : info.out_bd)
+            if (!retained(retained_out, t)) back += (double)(g.w * g.h);
 
-// ============================================================
-// Granularity & subgraph analysis
-// ============================================================
+        // Steps between breakpoints stream the same amount
+        vector<int64_t> cuts = {0, 1, steps - 1, steps};
+        for (auto [K, unit] : streams) {
+            cuts.push_back(min(steps, K / g.k));
+            cuts.push_back(min(steps, (K + g.k - 1) / g.k));
+        }
+        sort(cuts.begin(), cuts.end());
+        cuts.erase(unique(cuts.begin(), cuts.end()), cuts.end());
+        auto streamed = [&](int64_t s) {
+            double m = 0;
+            for (auto [K, unit] : streams)
+                if (s * g.k < K) m += (double)unit * min(g.k, K - s * g.k);
+            return m;
+        };
+        auto tile = [&](double first) {
+            double lat = 0;
+            for (size_t c = 0; c + 1 < cuts.size(); c++) {
+                int64_t s = cuts[c], n = cuts[c + 1] - s;
+                if (n <= 0 || s >= steps) continue;
+                double m = streamed(s);
+                if (s == 0) m += first;
+                if (s == steps - 1) m += back;
+                lat += n * max(compute_step, m / p.slow_bw);
+            }
+            return lat;
+        };
 
-struct Gran {
-    int64_t w, h, k;
-};
+        // Tiles by which pinned strips they reload: rows are contiguous in
+        // both raster and zig-zag; zig-zag also keeps the column at a row turn.
+        int64_t n = tiles_x * tiles_y;
+        int64_t both, only_l, only_r;
+        if (tiles_x == 1) {
+            both = 1;
+            only_l = n - 1;
+            only_r = 0;
+        } else if (zigzag) {
+            both = 1;
+            only_l = tiles_y - 1;
+            only_r = n - tiles_y;
+        } else {
+            both = tiles_y;
+            only_l = 0;
+            only_r = n - tiles_y;
+        }
+        double lat = both * tile(front + pin_l + pin_r);
+        if (only_l) lat += only_l * tile(front + pin_l);
+        if (only_r) lat += only_r * tile(front + pin_r);
+        return lat;
+    }
 
-// Reduction dimension K for a MatMul op (= LHS width = RHS height)
-int64_t get_K(const Problem& p, int oi) {
-    return p.tensors[p.ops[oi].ins[0]].w;
-}
-
-// Instantaneous slice size of a boundary INPUT tensor (for working-set check)
-// Takes the max across all consuming ops in the subgraph.
-int64_t input_slice(const Problem& p, int tidx, const vector<int>& ops, const Gran& g) {
-    int64_t best = 0;
-    for (int oi : ops) {
-        const Op& op = p.ops[oi];
-        for (int j = 0; j < (int)op.ins.size(); j++) {
-            if (op.ins[j] == tidx) {
-                int64_t s = (op.type == "MatMul")
-                    ? (j == 0 ? g.h * g.k : g.w * g.k)
-                    : g.w * g.h;
-                best = max(best, s);
-            }
-        }
-    }
-    return best > 0 ? best : g.w * g.h;
-}
-
-// Total memory transferred for a boundary INPUT tensor per spatial tile
-// (uses K_full for MatMul; takes max across consuming ops)
-int64_t tile_mem_in(const Problem& p, int tidx, const vector<int>& ops, const Gran& g) {
-    int64_t best = 0;
-    for (int oi : ops) {
-        const Op& op = p.ops[oi];
-        for (int j = 0; j < (int)op.ins.size(); j++) {
-            if (op.ins[j] == tidx) {
-                int64_t s;
-                if (op.type == "MatMul") {
-                    int64_t K = get_K(p, oi);
-                    s = j == 0 ? g.h * K : g.w * K;
-                } else {
-                    s = g.w * g.h;
+    // Cheapest pin set whose extra memory fits next to the streamed working
+    // set. Up to kMaxPinCands candidates (smallest first) are tried exhaustively.
+    static constexpr int kMaxPinCands = 5;
+    pair<uint32_t, double> best_pins(bool zigzag, const vector<int>& retained_in,
+                                     const vector<int>& retained_out,
+                                     int64_t spare) const {
+        vector<int> cands;
+        for (int i = 0; i < (int)info.in_bd.size() && i < 32; i++)
+            if (reuse_role(info.in_bd[i]) != 0 && !(info.in_bd[i].roles & ROLE_CHAIN) &&
+                pin_cost(info.in_bd[i]) <= spare &&
+                !binary_search(retained_in.begin(), retained_in.end(), info.in_bd[i].t))
+                cands.push_back(i);
+        sort(cands.begin(), cands.end(), [&](int a, int b) {
+            return make_pair(pin_cost(info.in_bd[a]), a) < make_pair(pin_cost(info.in_bd[b]), b);
+        });
+        if ((int)cands.size() > kMaxPinCands) cands.resize(kMaxPinCands);
+        uint32_t best = 0;
+        double best_lat = latency(0, zigzag, retained_in, retained_out);
+        for (uint32_t m = 1; m < (1u << cands.size()); m++) {
+            int64_t extra = 0;
+            uint32_t pins = 0;
+            for (size_t j = 0; j < cands.size(); j++)
+                if (m >> j & 1) {
+                    extra += pin_cost(info.in_bd[cands[j]]);
+                    pins |= 1u << cands[j];
                 }
-                best = max(best, s);
+            if (extra > spare) continue;
+            double lat = latency(pins, zigzag, retained_in, retained_out);
+            if (lat < best_lat) {
+                best_lat = lat;
+                best = pins;
             }
         }
+        return {best, best_lat};
     }
-    return best > 0 ? best : g.w * g.h;
-}
-
-struct SGInfo {
-    set<int> in_bd;   // input boundary tensors (need to load)
-    set<int> out_bd;  // output boundary tensors (need to evict)
-    set<int> ephem;   // ephemeral (internal) tensors
-    int64_t out_W, out_H;  // max output tensor dims (for spatial tiling)
 };
 
-SGInfo analyze(const Problem& p, const vector<int>& ops) {
-    set<int> opset(ops.begin(), ops.end());
-    set<int> produced, consumed;
-    for (int oi : ops) {
-        for (int t : p.ops[oi].outs) produced.insert(t);
-        for (int t : p.ops[oi].ins) consumed.insert(t);
-    }
-    SGInfo info{};
-    for (int t : consumed)
-        if (!produced.count(t)) info.in_bd.insert(t);
-    for (int t : produced) {
-        bool external = p.graph_outs.count(t) > 0;
-        if (!external)
-            for (int c : p.consumers[t])
-                if (!opset.count(c)) { external = true; break; }
-        if (external)
-            info.out_bd.insert(t);
-        else if (consumed.count(t))
-            info.ephem.insert(t);
-        else
-            info.out_bd.insert(t);  // dead value, treat as output
-    }
-    info.out_W = info.out_H = 0;
-    for (int oi : ops)
-        for (int t : p.ops[oi].outs) {
-            info.out_W = max(info.out_W, p.tensors[t].w);
-            info.out_H = max(info.out_H, p.tensors[t].h);
-        }
-    return info;
-}
-
-// Working set per tile (must fit in fast_cap)
-int64_t working_set(const Problem& p, const vector<int>& ops,
-                    const SGInfo& info, const Gran& g) {
-    int64_t ws = 0;
-    for (int t : info.in_bd) ws += input_slice(p, t, ops, g);
-    for ([[maybe_unused]] int t : info.out_bd) ws += g.w * g.h;
-    return ws;
-}
-
 // ============================================================
-// Latency model (per-tile roofline, raster order, no retention)
+// Latency model dispatch
 // ============================================================
 
-double calc_latency(const Problem& p, const vector<int>& ops,
-                    const SGInfo& info, const Gran& g) {
+// The search-time latency: tile_latency, or the step engine under
+// --model=step
+double calc_latency(const Problem& p, const SGInfo& info, const Gran& g) {
+    prof_count(Prof::CalcLatency);
     if (info.out_W <= 0 || info.out_H <= 0) return 0;
-
-    int64_t tiles_x = (info.out_W + g.w - 1) / g.w;
-    int64_t tiles_y = (info.out_H + g.h - 1) / g.h;
-    int64_t ntiles = tiles_x * tiles_y;
-
-    // --- Per spatial tile cost ---
-    // Compute: each op runs once per tile, padded to native
-    int64_t nat_scale = max((int64_t)1, (g.w + p.nat_w - 1) / p.nat_w) *
-                        max((int64_t)1, (g.h + p.nat_h - 1) / p.nat_h);
-    double compute = 0;
-    for (int oi : ops) compute += (double)p.ops[oi].base_cost;
-    compute *= nat_scale;
-
-    // Memory in: total per-tile transfer (full K for MatMul inputs)
-    double mem_in = 0;
-    for (int t : info.in_bd)
-        mem_in += (double)tile_mem_in(p, t, ops, g) / p.slow_bw;
-    // Memory out: boundary output tensor slices / bandwidth
-    double mem_out = 0;
-    for ([[maybe_unused]] int t : info.out_bd)
-        mem_out += (double)(g.w * g.h) / p.slow_bw;
-
-    double tile_lat = max(compute, mem_in + mem_out);
-    return ntiles * tile_lat;
+    if (g_model == LatencyModel::Step)
+        return StepModel(p, info, g).best_pins(false, {}, {}, p.fast_cap - working_set(info, g)).second;
+    return tile_latency(p, info, g);
 }
 
 // ============================================================
@@ -317,46 +217,406 @@ vector<int64_t> pow2_candidates(int64_t max_val) {
     return v;
 }
 
-// Returns {best_gran, best_latency}. If nothing fits, returns {{0,0,0}, inf}.
-pair<Gran, double> find_best_gran(const Problem& p, const vector<int>& ops) {
-    SGInfo info = analyze(p, ops);
-    if (info.out_W <= 0) return {{1, 1, 1}, 0};
+// Spatial sizes worth trying along one output dimension: powers of two up to
+// 2×out plus every multiple of the native size up to out (rounded up). Only
+// the smallest size per tile count is kept: for the same number of tiles it
+// needs no more memory, native padding or traffic than any larger size.
+vector<int64_t> dim_candidates(int64_t out, int64_t nat) {
+    vector<int64_t> c;
+    for (int64_t x = 1; x <= out * 2; x *= 2) c.push_back(x);
+    for (int64_t x = nat; x < out + nat; x += nat) c.push_back(x);
+    sort(c.begin(), c.end());
+    c.erase(unique(c.begin(), c.end()), c.end());
+    vector<int64_t> keep;
+    int64_t last_tiles = -1;
+    for (int64_t x : c) {
+        int64_t t = (out + x - 1) / x;
+        if (t != last_tiles) keep.push_back(x);
+        last_tiles = t;
+    }
+    return keep;
+}
+
+// working_set and per-tile traffic as polynomials in (w, h, k), with the
+// boundary inputs folded into per-role coefficients. Scoring a candidate is
+// a few multiply-adds; only inputs used in several roles (rare) keep a max.
+struct GranModel {
+    int64_t n_lhs = 0, n_rhs = 0;          // inputs sliced h×k / w×k
+    int64_t n_wh = 0;                      // pointwise inputs + outputs (w×h)
+    int64_t sum_K_lhs = 0, sum_K_rhs = 0;  // Σ full K over LHS / RHS inputs
+    vector<InBd> mixed;                    // inputs with more than one role
+    int64_t compute = 0;
+    int64_t nat_w = 1, nat_h = 1, slow_bw = 1;
+
+    GranModel(const Problem& p, const SGInfo& info)
+        : n_wh((int64_t)info.out_bd.size()), compute(info.compute),
+          nat_w(p.nat_w), nat_h(p.nat_h), slow_bw(p.slow_bw) {
+        for (const InBd& b : info.in_bd) {
+            if (b.roles == ROLE_LHS) { n_lhs++; sum_K_lhs += b.K_lhs; }
+            else if (b.roles == ROLE_RHS) { n_rhs++; sum_K_rhs += b.K_rhs; }
+            else if (b.roles == ROLE_PW) n_wh++;
+            else mixed.push_back(b);
+        }
+    }
+    int64_t ws(int64_t w, int64_t h, int64_t k) const {
+        int64_t s = n_lhs * h * k + n_rhs * w * k + n_wh * w * h;
+        for (const InBd& b : mixed) s += input_slice(b, {w, h, k});
+        return s;
+    }
+    int64_t tile_bytes(int64_t w, int64_t h) const {
+        int64_t s = sum_K_lhs * h + sum_K_rhs * w + n_wh * w * h;
+        for (const InBd& b : mixed) s += tile_mem_in(b, {w, h, 1});
+        return s;
+    }
+    // calc_latency with the traffic summed in integers
+    double lat(int64_t w, int64_t h, int64_t out_W, int64_t out_H) const {
+        int64_t ntiles = ((out_W + w - 1) / w) * ((out_H + h - 1) / h);
+        int64_t nat_scale = max((int64_t)1, (w + nat_w - 1) / nat_w) *
+                            max((int64_t)1, (h + nat_h - 1) / nat_h);
+        return ntiles * max((double)compute * nat_scale, (double)tile_bytes(w, h) / slow_bw);
+    }
+};
 
-    // Determine max K across MatMuls (0 if no MatMuls)
-    int64_t maxK = 0;
-    for (int oi : ops)
-        if (p.ops[oi].type == "MatMul")
-            maxK = max(maxK, get_K(p, oi));
+// Largest candidate k with ws ≤ cap (ws is monotone in k), 0 if none fits.
+int64_t max_feasible_k(const GranModel& m, int64_t w, int64_t h,
+                       const vector<int64_t>& ks, int64_t cap) {
+    int lo = 0, hi = (int)ks.size() - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (m.ws(w, h, ks[mid]) <= cap) { found = mid; lo = mid + 1; }
+        else hi = mid - 1;
+    }
+    return found < 0 ? 0 : ks[found];
+}
 
-    auto ws = pow2_candidates(max(info.out_W, info.out_H));
-    auto ks = pow2_candidates(max(maxK, (int64_t)1));
+// Compute-bound floor of a subgraph: every tile pays at least its compute.
+// Cheap to evaluate, so it screens out tiny tiles before the per-tile walk.
+double compute_floor(const Problem& p, const SGInfo& info, const Gran& g) {
+    int64_t ntiles = ((info.out_W + g.w - 1) / g.w) * ((info.out_H + g.h - 1) / g.h);
+    int64_t nat_scale = max((int64_t)1, (g.w + p.nat_w - 1) / p.nat_w) *
+                        max((int64_t)1, (g.h + p.nat_h - 1) / p.nat_h);
+    return (double)ntiles * info.compute * nat_scale;
+}
 
+// Tile-model search. Under calc_latency's tile roofline the latency does
+// not depend on k, so each (w, h) is scored once and paired with its
+// largest feasible k. Working set grows with w and h, so each scan stops at
+// the first size that does not fit even at the smallest k. Ties go to the
+// larger k, then the smaller working set. The step model breaks the k
+// shortcut, so it must never get here.
+pair<Gran, double> best_gran_tile(const Problem& p, const SGInfo& info, const GranModel& m,
+                                  const vector<int64_t>& wc, const vector<int64_t>& hc,
+                                  const vector<int64_t>& ks) {
+    assert(g_model == LatencyModel::Tile);
     Gran best{0, 0, 0};
     double best_lat = 1e30;
+    int64_t best_ws = 0;
+    uint64_t tried = 0, rejected = 0;  // --profile counts, flushed once
+    for (int64_t w : wc) {
+        if (m.ws(w, hc[0], ks[0]) > p.fast_cap) { rejected++; break; }
+        for (int64_t h : hc) {
+            if (m.ws(w, h, ks[0]) > p.fast_cap) { rejected++; break; }
+            tried++;
+            double lat = m.lat(w, h, info.out_W, info.out_H);
+            if (lat > best_lat) continue;
+            int64_t k = max_feasible_k(m, w, h, ks, p.fast_cap);
+            int64_t ws = m.ws(w, h, k);
+            if (lat < best_lat || k > best.k || (k == best.k && ws < best_ws)) {
+                best_lat = lat;
+                best = {w, h, k};
+                best_ws = ws;
+            }
+        }
+    }
+    prof_count(Prof::GranTried, tried);
+    prof_count(Prof::GranCapReject, rejected);
+    if (best.w == 0) return {best, best_lat};
+    return {best, calc_latency(p, info, best)};
+}
 
-    // Search large→small so we prefer bigger tiles when latency ties
-    for (int ki = (int)ks.size() - 1; ki >= 0; ki--) {
-        int64_t kv = ks[ki];
-        if (maxK > 0 && kv > maxK) continue;
-        for (int wi = (int)ws.size() - 1; wi >= 0; wi--) {
-            int64_t wv = ws[wi];
-            if (wv > info.out_W * 2) continue;
-            for (int hi = (int)ws.size() - 1; hi >= 0; hi--) {
-                int64_t hv = ws[hi];
-                if (hv > info.out_H * 2) continue;
-                Gran g{wv, hv, maxK > 0 ? kv : 1};
-                if (working_set(p, ops, info, g) > p.fast_cap) continue;
-                double lat = calc_latency(p, ops, info, g);
-                if (lat < best_lat) {
+// Step-model search: latency depends on k once steps are modeled, so every
+// feasible k of each (w, h) is scored. Ties go to the larger k.
+pair<Gran, double> best_gran_step(const Problem& p, const SGInfo& info, const GranModel& m,
+                                  const vector<int64_t>& wc, const vector<int64_t>& hc,
+                                  const vector<int64_t>& ks) {
+    Gran best{0, 0, 0};
+    double best_lat = 1e30;
+    uint64_t tried = 0, rejected = 0;
+    for (int64_t w : wc)
+        for (int64_t h : hc) {
+            int64_t kmax = max_feasible_k(m, w, h, ks, p.fast_cap);
+            if (kmax == 0) { rejected++; break; }
+            for (int64_t k : ks) {
+                if (k > kmax) break;
+                Gran g{w, h, k};
+                if (compute_floor(p, info, g) >= best_lat) break;
+                tried++;
+                double lat = calc_latency(p, info, g);
+                if (lat < best_lat || (lat == best_lat && k > best.k)) {
                     best_lat = lat;
                     best = g;
                 }
             }
         }
-    }
+    prof_count(Prof::GranTried, tried);
+    prof_count(Prof::GranCapReject, rejected);
     return {best, best_lat};
 }
 
+// Returns {best_gran, best_latency} under g_model. If nothing fits,
+// returns {{0,0,0}, inf}.
+pair<Gran, double> find_best_gran(const Problem& p, const SGInfo& info) {
+    prof_count(Prof::FindBestGran);
+    if (info.out_W <= 0) return {{1, 1, 1}, 0};
+
+    GranModel m(p, info);
+    auto wc = dim_candidates(info.out_W, p.nat_w);
+    auto hc = dim_candidates(info.out_H, p.nat_h);
+    // max K across MatMuls (0 if no MatMuls → k is fixed at 1)
+    auto ks = info.maxK > 0 ? pow2_candidates(info.maxK) : vector<int64_t>{1};
+    if (g_model == LatencyModel::Step) return best_gran_step(p, info, m, wc, hc, ks);
+    return best_gran_tile(p, info, m, wc, hc, ks);
+}
+
+// ============================================================
+// Progress log
+// ============================================================
+
+// Where stage summaries go. Batch workers point it at a per-problem buffer
+// so concurrent solves do not interleave; errors always go to stderr.
+thread_local ostream* g_log = &cerr;
+ostream& logs() { return *g_log; }
+
+// ============================================================
+// Subgraph cost cache — memoizes find_best_gran by op set
+// ============================================================
+
+// Canonical op-set key: the sorted op ids, so its size follows the set's
+// size rather than the graph's. `h` is Σ mix(id), kept up to date on every
+// edit, so hashing is O(1) and a union of disjoint sets adds hashes.
+struct OpMask {
+    vector<int> ids;  // sorted, unique
+    uint64_t h = 0;
+
+    static uint64_t mix(int oi) {  // splitmix64 finalizer
+        uint64_t z = (uint64_t)oi + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    static OpMask of(vector<int> ops) {
+        OpMask m;
+        sort(ops.begin(), ops.end());
+        ops.erase(unique(ops.begin(), ops.end()), ops.end());
+        for (int oi : ops) m.h += mix(oi);
+        m.ids = move(ops);
+        return m;
+    }
+    void set(int oi) {
+        auto it = lower_bound(ids.begin(), ids.end(), oi);
+        if (it != ids.end() && *it == oi) return;
+        ids.insert(it, oi);
+        h += mix(oi);
+    }
+    void reset(int oi) {
+        auto it = lower_bound(ids.begin(), ids.end(), oi);
+        if (it == ids.end() || *it != oi) return;
+        ids.erase(it);
+        h -= mix(oi);
+    }
+    bool test(int oi) const { return binary_search(ids.begin(), ids.end(), oi); }
+    OpMask operator|(const OpMask& o) const {
+        OpMask r;
+        r.ids.reserve(ids.size() + o.ids.size());
+        set_union(ids.begin(), ids.end(), o.ids.begin(), o.ids.end(), back_inserter(r.ids));
+        if (r.ids.size() == ids.size() + o.ids.size()) r.h = h + o.h;  // disjoint
+        else for (int oi : r.ids) r.h += mix(oi);
+        return r;
+    }
+    OpMask& operator|=(const OpMask& o) { return *this = *this | o; }
+    bool operator==(const OpMask& o) const { return h == o.h && ids == o.ids; }
+};
+
+struct OpMaskHash {
+    size_t operator()(const OpMask& m) const { return (size_t)m.h; }
+};
+
+// analyze() of op sets, shared by every problem of a batch with the same
+// graph: boundaries and compute depend only on the ops and tensor shapes,
+// never on fast_cap or slow_bw. Safe to use from any thread.
+struct SharedAnalysis {
+    shared_mutex mu;
+    unordered_map<OpMask, SGInfo, OpMaskHash> infos;
+    atomic<int64_t> hits{0}, misses{0};
+
+    SGInfo get(const Problem& p, const OpMask& key, const vector<int>& ops) {
+        {
+            shared_lock<shared_mutex> lk(mu);
+            auto it = infos.find(key);
+            if (it != infos.end()) { hits++; return it->second; }
+        }
+        misses++;
+        SGInfo info = analyze(p, ops);
+        unique_lock<shared_mutex> lk(mu);
+        infos.emplace(key, info);
+        return info;
+    }
+};
+
+struct CostEntry {
+    Gran gran;
+    double lat;
+    SGInfo info;
+    // Under the final model (best traversal, no retention). Only fusion
+    // runs that score with it fill these; final_lat < 0 until then.
+    Gran final_gran{0, 0, 0};
+    double final_lat = -1;
+};
+
+// Best granularity, latency and analysis depend only on the op set, so every
+// candidate merge that was already scored in an earlier round is a lookup.
+struct CostCache {
+    unordered_map<OpMask, CostEntry, OpMaskHash> map;
+    // Op sets the exact search scored (ExactSearch::cost): granularity and
+    // latency under the fusion model, plus the working set for carry_to.
+    // Most are never fused, so they skip the full CostEntry. An entry
+    // carried to a capacity its granularity no longer fits is not exact,
+    // only a lower bound on the latency there.
+    struct Scored { Gran gran; double lat; int64_t ws; bool exact; };
+    unordered_map<OpMask, Scored, OpMaskHash> scored;
+    int64_t hits = 0, misses = 0;
+    SharedAnalysis* shared = nullptr;  // batch mode: analysis across problems
+
+    SGInfo analyze_set(const Problem& p, const OpMask& key, const vector<int>& ops) {
+        return shared ? shared->get(p, key, ops) : analyze(p, ops);
+    }
+
+    // Scores ops_a ∪ ops_b; the merged op list is only built on a miss.
+    const CostEntry& lookup(const Problem& p, const OpMask& key,
+                            const vector<int>& ops_a, const vector<int>& ops_b = {}) {
+        auto it = map.find(key);
+        if (it != map.end()) { hits++; return it->second; }
+        misses++;
+        vector<int> ops = ops_a;
+        ops.insert(ops.end(), ops_b.begin(), ops_b.end());
+        SGInfo info = analyze_set(p, key, ops);
+        auto [g, lat] = find_best_gran(p, info);
+        return map.emplace(key, CostEntry{g, lat, move(info)}).first->second;
+    }
+
+    // Readies the cache for p after it scored the same graph at the same
+    // bandwidth and a capacity at least p's (a sweep). Tile-model latencies
+    // do not depend on the capacity, so a best granularity that still fits
+    // is still the best and keeps its k. One that does not fit drops out of
+    // map; in scored its latency stays as a bound, since less capacity only
+    // removes granularities and lowers k. Final-model scores only carry
+    // under adjacent strip reuse, since the LRU charges by spare room, and
+    // the step model's pins depend on it throughout.
+    void carry_to(const Problem& p) {
+        if (g_model == LatencyModel::Step) {
+            map.clear();
+            scored.clear();
+            return;
+        }
+        if (g_strip_cache == StripCache::Lru) scored.clear();
+        for (auto& [key, sc] : scored)
+            if (sc.gran.w != 0 && sc.ws > p.fast_cap) sc.exact = false;
+        auto fits = [&](const CostEntry& e, const Gran& g) {
+            return g.w == 0 || working_set(e.info, g) <= p.fast_cap;
+        };
+        for (auto it = map.begin(); it != map.end();) {
+            CostEntry& e = it->second;
+            if (!fits(e, e.gran)) {
+                it = map.erase(it);
+                continue;
+            }
+            if (g_strip_cache == StripCache::Lru || !fits(e, e.final_gran)) {
+                e.final_gran = {0, 0, 0};
+                e.final_lat = -1;
+            }
+            ++it;
+        }
+    }
+
+    void report() const {
+        int64_t total = hits + misses;
+        logs() << "Cost cache: " << hits << " hits, " << misses << " misses ("
+               << (total ? 100.0 * hits / total : 0.0) << "% hit), "
+               << map.size() << " entries" << endl;
+    }
+};
+
+// ============================================================
+// Thread pool for candidate scoring
+// ============================================================
+
+// Fixed set of workers plus the calling thread. parallel_for blocks until
+// every index has run; callers keep results in per-index slots so the
+// reduction order (and therefore the output) is independent of thread count.
+class ThreadPool {
+public:
+    explicit ThreadPool(int nthreads) {
+        for (int i = 1; i < nthreads; i++) workers.emplace_back([this] { worker(); });
+    }
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lk(m);
+            quit = true;
+        }
+        cv.notify_all();
+        for (auto& t : workers) t.join();
+    }
+    int size() const { return (int)workers.size() + 1; }
+
+    void parallel_for(int n, const function<void(int)>& fn) {
+        if (workers.empty() || n <= 1) {
+            for (int i = 0; i < n; i++) fn(i);
+            return;
+        }
+        {
+            lock_guard<mutex> lk(m);
+            job = &fn;
+            job_n = n;
+            next = 0;
+            pending = (int)workers.size();
+            generation++;
+        }
+        cv.notify_all();
+        drain();
+        unique_lock<mutex> lk(m);
+        done_cv.wait(lk, [&] { return pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    void drain() {
+        for (int i; (i = next.fetch_add(1)) < job_n;) (*job)(i);
+    }
+    void worker() {
+        uint64_t seen = 0;
+        for (;;) {
+            unique_lock<mutex> lk(m);
+            cv.wait(lk, [&] { return quit || generation != seen; });
+            if (quit) return;
+            seen = generation;
+            lk.unlock();
+            drain();
+            lk.lock();
+            if (--pending == 0) done_cv.notify_one();
+        }
+    }
+
+    vector<thread> workers;
+    mutex m;
+    condition_variable cv, done_cv;
+    const function<void(int)>* job = nullptr;
+    int job_n = 0;
+    atomic<int> next{0};
+    int pending = 0;
+    uint64_t generation = 0;
+    bool quit = false;
+};
+
 // ============================================================
 // DAG utilities
 // ============================================================
@@ -368,8 +628,8 @@ vector<int> topo_sort(const Problem& p) {
     vector<vector<int>> adj(n);  // op -> successor ops
 
     for (int i = 0; i < n; i++)
-        for (int t : p.ops[i].outs)
-            for (int c : p.consumers[t])
+        for (int t : p.outs(i))
+            for (int c : p.consumers(t))
                 if (c != i) {
                     adj[i].push_back(c);
                     indeg[c]++;
@@ -404,13 +664,24 @@ vector<int> topo_sort(const Problem& p) {
 // Greedy fusion
 // ============================================================
 
+// Tile orders tried per subgraph. Indices are row-major (ty * tiles_x + tx).
+enum class Traversal : uint8_t { Raster, RowSnake, ColSnake, BlockRow, BlockCol, Hilbert, Morton };
+const char* traversal_name(Traversal t) {
+    static const char* names[] = {"raster", "row-snake", "col-snake", "block-row",
+                                  "block-col", "hilbert", "morton"};
+    return names[(int)t];
+}
+
 struct Subgraph {
     vector<int> ops;
+    OpMask mask;             // ops as a bitset (cost-cache key)
     Gran gran;
     double latency;
     bool active = true;
+    int version = 0;         // bumped on every merge (stale heap entries)
     vector<int> retain;      // tensors to keep in fast mem for next SG
     vector<int> traversal;   // tile traversal order (empty = raster/null)
+    Traversal trav_kind = Traversal::Raster;
 };
 
 // Check if merging sg_a into sg_b would create a cycle in the subgraph DAG
@@ -419,14 +690,15 @@ bool creates_cycle(int sg_a, int sg_b,
                    const vector<Subgraph>& sgs,
                    const vector<int>& op_to_sg,
                    const Problem& p) {
+    prof_count(Prof::CreatesCycle);
     // BFS from sg_a's successors (excluding sg_b) to see if sg_b is reachable
     set<int> visited;
     queue<int> q;
 
     // Find all successor subgraphs of sg_a
     for (int oi : sgs[sg_a].ops)
-        for (int t : p.ops[oi].outs)
-            for (int c : p.consumers[t]) {
+        for (int t : p.outs(oi))
+            for (int c : p.consumers(t)) {
                 int s = op_to_sg[c];
                 if (s != sg_a && s != sg_b && sgs[s].active && !visited.count(s)) {
                     visited.insert(s);
@@ -439,8 +711,8 @@ bool creates_cycle(int sg_a, int sg_b,
         q.pop();
         // Check if cur reaches sg_b
         for (int oi : sgs[cur].ops)
-            for (int t : p.ops[oi].outs)
-                for (int c : p.consumers[t]) {
+            for (int t : p.outs(oi))
+                for (int c : p.consumers(t)) {
                     int s = op_to_sg[c];
                     if (s == sg_b) return true;
                     if (s != cur && sgs[s].active && !visited.count(s)) {
@@ -452,130 +724,476 @@ bool creates_cycle(int sg_a, int sg_b,
     return false;
 }
 
-// Find adjacent subgraph pairs (producer -> consumer via tensor)
-vector<pair<int, int>> adjacent_pairs(const vector<Subgraph>& sgs,
-                                      const vector<int>& op_to_sg,
-                                      const Problem& p) {
-    set<pair<int, int>> pairs;
-    for (int si = 0; si < (int)sgs.size(); si++) {
-        if (!sgs[si].active) continue;
-        for (int oi : sgs[si].ops)
-            for (int t : p.ops[oi].outs)
-                for (int c : p.consumers[t]) {
-                    int sj = op_to_sg[c];
-                    if (sj != si && sgs[sj].active)
-                        pairs.insert({si, sj});
-                }
+// ============================================================
+// Deadline and SIGTERM
+// ============================================================
+
+volatile sig_atomic_t g_stop = 0;
+
+extern "C" void on_stop_signal(int) { g_stop = 1; }
+
+struct Deadline {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point end;
+    bool has_end = false;
+
+    // MLSYS_DEADLINE_MS: wall-clock budget in ms from process start
+    static Deadline from_env() {
+        Deadline d;
+        if (const char* s = getenv("MLSYS_DEADLINE_MS")) {
+            d.has_end = true;
+            d.end = d.start + chrono::milliseconds(atoll(s));
+        }
+        return d;
     }
-    return vector<pair<int, int>>(pairs.begin(), pairs.end());
-}
+    bool expired() const {
+        return g_stop || (has_end && chrono::steady_clock::now() >= end);
+    }
+    double elapsed_ms() const {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    // A deadline `frac` of the way from now to this one (same if unbounded)
+    Deadline share(double frac) const {
+        Deadline d = *this;
+        if (has_end) {
+            auto now = chrono::steady_clock::now();
+            d.end = now + chrono::duration_cast<chrono::steady_clock::duration>((end - now) * frac);
+        }
+        return d;
+    }
+};
 
-vector<Subgraph> greedy_fusion(const Problem& p) {
-    int n = (int)p.ops.size();
+// ============================================================
+// Incremental merge engine
+// ============================================================
 
-    // Initialize: each op is its own subgraph
-    vector<Subgraph> sgs(n);
-    vector<int> op_to_sg(n);
-    for (int i = 0; i < n; i++) {
-        sgs[i].ops = {i};
-        op_to_sg[i] = i;
-        auto [g, lat] = find_best_gran(p, sgs[i].ops);
-        sgs[i].gran = g;
-        sgs[i].latency = lat;
-    }
-
-    // Phase 1: merge pairs with positive latency benefit
-    bool changed = true;
-    while (changed) {
-        changed = false;
-        auto pairs = adjacent_pairs(sgs, op_to_sg, p);
-
-        int best_a = -1, best_b = -1;
-        double best_benefit = 0;
-        Gran best_gran{};
-        double best_lat = 0;
-
-        for (auto [sa, sb] : pairs) {
-            if (creates_cycle(sa, sb, sgs, op_to_sg, p)) continue;
-
-            vector<int> merged_ops = sgs[sa].ops;
-            merged_ops.insert(merged_ops.end(), sgs[sb].ops.begin(), sgs[sb].ops.end());
-
-            auto [g, lat] = find_best_gran(p, merged_ops);
-            if (g.w == 0) continue;
-
-            double benefit = (sgs[sa].latency + sgs[sb].latency) - lat;
-            if (benefit > best_benefit) {
-                best_benefit = benefit;
-                best_a = sa;
-                best_b = sb;
-                best_gran = g;
-                best_lat = lat;
+// A scored merge of producer `a` into consumer `b`. The version stamps record
+// the state both subgraphs were in when it was scored; a merge bumps them, so
+// stale entries are recognised (and dropped) when they reach the top.
+struct MergeCand {
+    double score;
+    int a, b;
+    int va, vb;
+    // Max-heap order: higher score first, then the lowest (a, b) pair —
+    // the same winner the original full-rescan loop picked.
+    bool operator<(const MergeCand& o) const {
+        if (score != o.score) return score < o.score;
+        if (a != o.a) return a > o.a;
+        return b > o.b;
+    }
+};
+
+struct FusionState {
+    const Problem& p;
+    vector<Subgraph> sgs;
+    vector<int> op_to_sg;
+    vector<set<int>> succ, pred;  // subgraph DAG (active subgraphs only)
+    CostCache& cache;  // may be shared across searches of the same problem
+    // ord[s] is the position of subgraph s in a topological order of the
+    // subgraph DAG, so a path into b only passes subgraphs ordered before
+    // b. Merges keep the order valid by reordering the interval between the
+    // two subgraphs (contract_order). Positions of merged-away subgraphs go
+    // stale but are never queried again. Empty while seeding.
+    vector<int> ord;
+    vector<uint32_t> seen;  // visit stamps for the interval searches
+    uint32_t epoch = 0;
+    int64_t reach_checks = 0, reach_mismatches = 0;
+    ThreadPool* pool;  // candidate scoring fan-out (nullptr = serial)
+    // Fills the final-model fields of each entry scored; when set, subgraph
+    // granularities and latencies come from them (nullptr = calc_latency).
+    void (*finish)(const Problem&, CostEntry&);
+    bool keep_handoffs = false;  // charge merges for the retention they give up
+    // Polled every kPollPops heap pops; a phase that sees it expire stops
+    // with the partition it has, and `cut` records that it did.
+    static constexpr int kPollPops = 64;
+    const Deadline* dl = nullptr;
+    bool cut = false;
+
+    bool out_of_time(int pops) {
+        if (!cut && dl && pops % kPollPops == 0 && dl->expired()) cut = true;
+        return cut;
+    }
+
+    FusionState(const Problem& prob, CostCache& cc, ThreadPool* tp,
+                void (*fin)(const Problem&, CostEntry&) = nullptr)
+        : p(prob), cache(cc), pool(tp), finish(fin) {
+        int n = (int)p.ops.size();
+        sgs.resize(n);
+        op_to_sg.resize(n);
+        succ.resize(n);
+        pred.resize(n);
+        vector<pair<int, int>> singles;
+        for (int i = 0; i < n; i++) {
+            sgs[i].ops = {i};
+            sgs[i].mask = OpMask::of({i});
+            op_to_sg[i] = i;
+            singles.push_back({i, -1});
+        }
+        prefetch(singles);
+        for (int i = 0; i < n; i++) {
+            const CostEntry& e = cache.map.at(sgs[i].mask);
+            sgs[i].gran = gran_of(e);
+            sgs[i].latency = lat_of(e);
+        }
+        for (int i = 0; i < n; i++)
+            for (int t : p.outs(i))
+                for (int c : p.consumers(t))
+                    if (c != i) {
+                        succ[i].insert(c);
+                        pred[c].insert(i);
+                    }
+        build_order();
+    }
+
+    // Topological order of the active subgraphs
+    void build_order() {
+        int n = (int)sgs.size();
+        ord.assign(n, -1);
+        seen.assign(n, 0);
+        epoch = 0;
+        vector<int> indeg(n, 0), order;
+        for (int a = 0; a < n; a++)
+            for (int b : succ[a]) indeg[b]++;
+        for (int a = 0; a < n; a++)
+            if (sgs[a].active && indeg[a] == 0) order.push_back(a);
+        for (size_t i = 0; i < order.size(); i++)
+            for (int b : succ[order[i]])
+                if (--indeg[b] == 0) order.push_back(b);
+        for (int i = 0; i < (int)order.size(); i++) ord[order[i]] = i;
+    }
+
+    uint32_t next_epoch() {
+        if (++epoch == 0) {  // wrapped: clear stale stamps
+            fill(seen.begin(), seen.end(), 0);
+            epoch = 1;
+        }
+        return epoch;
+    }
+
+    // Subgraphs reachable from `from` (excluding `skip`) through edges of
+    // `adj`, visiting only those whose position passes `keep`
+    template <class Keep>
+    vector<int> interval_search(const vector<int>& from, int skip,
+                                const vector<set<int>>& adj, Keep keep) {
+        uint32_t ep = next_epoch();
+        vector<int> found;
+        for (int x : from)
+            if (x != skip && keep(x) && seen[x] != ep) {
+                seen[x] = ep;
+                found.push_back(x);
             }
+        for (size_t i = 0; i < found.size(); i++)
+            for (int y : adj[found[i]])
+                if (y != skip && keep(y) && seen[y] != ep) {
+                    seen[y] = ep;
+                    found.push_back(y);
+                }
+        return found;
+    }
+
+    // A seed group still pays if no single op of it is cheaper on its own
+    // beside the rest. Groups from another capacity or bandwidth can fit
+    // here and still lose to a split, which greedy never undoes.
+    bool still_pays(const vector<int>& g, const OpMask& key, double whole) {
+        vector<int> rest;
+        for (size_t x = 0; x < g.size(); x++) {
+            rest.assign(g.begin(), g.end());
+            rest.erase(rest.begin() + x);
+            OpMask rk = key;
+            rk.reset(g[x]);
+            cache.lookup(p, rk, rest);
+            CostEntry& e = cache.map.at(rk);
+            if (e.gran.w == 0) continue;
+            if (finish && e.final_lat < 0) finish(p, e);
+            if (lat_of(e) + sgs[op_to_sg[g[x]]].latency < whole - 1e-6) return false;
+        }
+        return true;
+    }
+
+    // Warm start: contract each group of a known partition (the subgraphs
+    // of a valid schedule of this graph, so every group is convex) that
+    // has a feasible granularity here. Groups that no longer fit stay as
+    // singletons for the greedy phases to re-fuse.
+    int seed(const vector<vector<int>>& groups) {
+        ord.clear();  // rebuilt once below instead of per merge
+        int merged = 0;
+        for (const vector<int>& g : groups) {
+            if (g.size() < 2) continue;
+            OpMask key = OpMask::of(g);
+            cache.lookup(p, key, g);
+            CostEntry& e = cache.map.at(key);
+            if (e.gran.w == 0) continue;
+            if (finish && e.final_lat < 0) finish(p, e);
+            if (!still_pays(g, key, lat_of(e))) continue;
+            int a = op_to_sg[g[0]];
+            for (size_t i = 1; i < g.size(); i++) merge(a, op_to_sg[g[i]], e);
+            merged++;
         }
+        build_order();
+        return merged;
+    }
 
-        if (best_a >= 0 && best_benefit > 0) {
-            for (int oi : sgs[best_b].ops) {
-                sgs[best_a].ops.push_back(oi);
-                op_to_sg[oi] = best_a;
+    // Merging a into its successor b creates a cycle iff b is also reachable
+    // through some other successor of a. Such a path stays between the two
+    // in the topological order, so only that interval is searched.
+    bool merge_creates_cycle(int a, int b) {
+        prof_count(Prof::CycleQuery);
+        if (ord.empty()) return creates_cycle(a, b, sgs, op_to_sg, p);
+        int hi = ord[b];
+        bool cyc = false;
+        uint32_t ep = next_epoch();
+        vector<int> todo;
+        for (int x : succ[a])
+            if (x != b && ord[x] < hi) {
+                seen[x] = ep;
+                todo.push_back(x);
+            }
+        while (!todo.empty() && !cyc) {
+            int x = todo.back();
+            todo.pop_back();
+            for (int y : succ[x]) {
+                if (y == b) { cyc = true; break; }
+                if (ord[y] < hi && seen[y] != ep) {
+                    seen[y] = ep;
+                    todo.push_back(y);
+                }
             }
-            sgs[best_a].gran = best_gran;
-            sgs[best_a].latency = best_lat;
-            sgs[best_b].active = false;
-            sgs[best_b].ops.clear();
-            changed = true;
         }
+#ifdef MLSYS_CHECK_REACH
+        reach_checks++;
+        if (cyc != creates_cycle(a, b, sgs, op_to_sg, p)) {
+            reach_mismatches++;
+            cerr << "Reach mismatch: SG " << a << " -> SG " << b
+                 << " index=" << cyc << endl;
+        }
+#endif
+        return cyc;
+    }
+
+    // Called before b is contracted into a. The merged node must follow
+    // every ancestor of b and precede every descendant of a. Only those
+    // inside the interval (ord[a], ord[b]) are out of place, and the two
+    // sets are disjoint, since the merge is acyclic. Their positions and
+    // those of a and b are handed out again: ancestors of b first, then
+    // a, then descendants of a, each group in its old order (Pearce and
+    // Kelly's reordering).
+    void contract_order(int a, int b) {
+        if (ord.empty()) return;
+        int lo = ord[a], hi = ord[b];
+        vector<int> down = interval_search(vector<int>(succ[a].begin(), succ[a].end()), b, succ,
+                                           [&](int x) { return ord[x] < hi; });
+        vector<int> up = interval_search(vector<int>(pred[b].begin(), pred[b].end()), a, pred,
+                                         [&](int x) { return ord[x] > lo; });
+        auto by_ord = [&](int x, int y) { return ord[x] < ord[y]; };
+        sort(down.begin(), down.end(), by_ord);
+        sort(up.begin(), up.end(), by_ord);
+        vector<int> slots = {lo, hi};
+        for (int x : down) slots.push_back(ord[x]);
+        for (int x : up) slots.push_back(ord[x]);
+        sort(slots.begin(), slots.end());
+        size_t i = 0;
+        for (int x : up) ord[x] = slots[i++];
+        ord[a] = slots[i++];
+        for (int x : down) ord[x] = slots[i++];
     }
 
-    // Phase 2: merge pairs with zero latency cost that create ephemeral tensors
-    changed = true;
-    while (changed) {
-        changed = false;
-        auto pairs = adjacent_pairs(sgs, op_to_sg, p);
+    Gran gran_of(const CostEntry& e) const { return finish ? e.final_gran : e.gran; }
+    double lat_of(const CostEntry& e) const { return finish ? e.final_lat : e.lat; }
+
+    // Make sure every pair (a, b) — or subgraph a alone when b < 0 — is in
+    // the cost cache. Misses are scored on the pool into per-slot results and
+    // inserted in pair order, so the cache and the merge sequence are the
+    // same for any thread count.
+    void prefetch(const vector<pair<int, int>>& pairs) {
+        vector<pair<int, int>> todo;
+        vector<OpMask> keys;
+        for (auto [a, b] : pairs) {
+            OpMask key = b < 0 ? sgs[a].mask : sgs[a].mask | sgs[b].mask;
+            auto it = cache.map.find(key);
+            if (it != cache.map.end()) {
+                cache.hits++;
+                // entries from a calc_latency-only lookup
+                if (finish && it->second.final_lat < 0) finish(p, it->second);
+                continue;
+            }
+            cache.misses++;
+            todo.push_back({a, b});
+            keys.push_back(move(key));
+        }
+        vector<CostEntry> res(todo.size());
+        auto score = [&](int i) {
+            auto [a, b] = todo[i];
+            vector<int> ops = sgs[a].ops;
+            if (b >= 0) ops.insert(ops.end(), sgs[b].ops.begin(), sgs[b].ops.end());
+            res[i].info = cache.analyze_set(p, keys[i], ops);
+            tie(res[i].gran, res[i].lat) = find_best_gran(p, res[i].info);
+            if (finish) finish(p, res[i]);
+        };
+        if (pool) pool->parallel_for((int)todo.size(), score);
+        else for (int i = 0; i < (int)todo.size(); i++) score(i);
+        for (size_t i = 0; i < todo.size(); i++)
+            cache.map.emplace(move(keys[i]), move(res[i]));
+    }
 
-        int best_a = -1, best_b = -1;
-        int best_ephem = 0;
-        Gran best_gran{};
-        double best_lat = 0;
+    const CostEntry& merged_cost(int a, int b) {
+        return cache.map.at(sgs[a].mask | sgs[b].mask);
+    }
 
-        for (auto [sa, sb] : pairs) {
-            if (creates_cycle(sa, sb, sgs, op_to_sg, p)) continue;
+    // Absorb subgraph b into a and splice b's edges onto a.
+    void merge(int a, int b, const CostEntry& e) {
+        for (int oi : sgs[b].ops) {
+            sgs[a].ops.push_back(oi);
+            op_to_sg[oi] = a;
+        }
+        sgs[a].mask |= sgs[b].mask;
+        sgs[b].mask = OpMask();
+        sgs[a].gran = gran_of(e);
+        sgs[a].latency = lat_of(e);
+        sgs[a].version++;
+        sgs[b].active = false;
+        sgs[b].version++;
+        sgs[b].ops.clear();
 
-            vector<int> merged_ops = sgs[sa].ops;
-            merged_ops.insert(merged_ops.end(), sgs[sb].ops.begin(), sgs[sb].ops.end());
+        contract_order(a, b);
+        for (int x : succ[b]) {
+            pred[x].erase(b);
+            if (x != a) { succ[a].insert(x); pred[x].insert(a); }
+        }
+        for (int x : pred[b]) {
+            succ[x].erase(b);
+            if (x != a) { pred[a].insert(x); succ[x].insert(a); }
+        }
+        succ[a].erase(b);
+        pred[a].erase(b);
+        succ[b].clear();
+        pred[b].clear();
+    }
 
-            auto [g, lat] = find_best_gran(p, merged_ops);
-            if (g.w == 0) continue;
+    // Run one greedy phase: repeatedly apply the best-scoring merge until the
+    // heap is exhausted (or the deadline passes). `score(a, b, cost, out)` returns false to reject a
+    // pair; it runs on the pool, so it may only read the state. Only pairs
+    // around the last merge are (re)scored; everything else stays in the
+    // heap. Hand-off charges also read the pair's neighbours, so with
+    // keep_handoffs the merged node's neighbours get new versions and every
+    // pair at them is rescored too. Merging can only add reachability
+    // between the other subgraphs, so a pair found to be cyclic is dropped
+    // for good.
+    template <class Score>
+    int run_phase(Score score) {
+        priority_queue<MergeCand> heap;
+        vector<double> scores;
+        vector<char> keep;
+        auto push_all = [&](const vector<pair<int, int>>& batch) {
+            prefetch(batch);
+            int n = (int)batch.size();
+            scores.assign(n, 0);
+            keep.assign(n, 0);
+            auto one = [&](int i) {
+                auto [a, b] = batch[i];
+                const CostEntry& e = merged_cost(a, b);
+                keep[i] = e.gran.w != 0 && score(a, b, e, scores[i]);
+            };
+            if (pool) pool->parallel_for(n, one);
+            else for (int i = 0; i < n; i++) one(i);
+            for (int i = 0; i < n; i++)
+                if (keep[i]) {
+                    auto [a, b] = batch[i];
+                    heap.push({scores[i], a, b, sgs[a].version, sgs[b].version});
+                }
+        };
+        vector<pair<int, int>> batch;
+        for (int a = 0; a < (int)sgs.size(); a++)
+            if (sgs[a].active)
+                for (int b : succ[a]) batch.push_back({a, b});
+        push_all(batch);
 
-            double benefit = (sgs[sa].latency + sgs[sb].latency) - lat;
-            if (benefit < -1e-6) continue;  // don't merge if it increases latency
+        int merges = 0;
+        vector<int> around;
+        for (int pops = 1; !heap.empty() && !out_of_time(pops); pops++) {
+            MergeCand c = heap.top();
+            heap.pop();
+            if (!sgs[c.a].active || !sgs[c.b].active) continue;
+            if (sgs[c.a].version != c.va || sgs[c.b].version != c.vb) continue;
+            if (merge_creates_cycle(c.a, c.b)) continue;
 
-            int n_ephem = (int)analyze(p, merged_ops).ephem.size();
-            if (n_ephem > best_ephem) {
-                best_ephem = n_ephem;
-                best_a = sa;
-                best_b = sb;
-                best_gran = g;
-                best_lat = lat;
+            merge(c.a, c.b, merged_cost(c.a, c.b));
+            merges++;
+            around = {c.a};
+            if (keep_handoffs && finish) {
+                for (int x : succ[c.a]) around.push_back(x);
+                for (int x : pred[c.a]) around.push_back(x);
+                for (size_t i = 1; i < around.size(); i++) sgs[around[i]].version++;
+            }
+            batch.clear();
+            for (int y : around) {
+                for (int x : succ[y]) batch.push_back({y, x});
+                for (int x : pred[y]) batch.push_back({x, y});
             }
+            sort(batch.begin(), batch.end());
+            batch.erase(unique(batch.begin(), batch.end()), batch.end());
+            push_all(batch);
         }
+        return merges;
+    }
 
-        if (best_a >= 0 && best_ephem > 0) {
-            for (int oi : sgs[best_b].ops) {
-                sgs[best_a].ops.push_back(oi);
-                op_to_sg[oi] = best_a;
+    // Ephemeral count of a ∪ b from the parts' cached analyses: a boundary
+    // output of either part turns internal when every reader is in the pair.
+    int merged_ephem(int a, int b) {
+        const SGInfo& ia = cache.map.at(sgs[a].mask).info;
+        const SGInfo& ib = cache.map.at(sgs[b].mask).info;
+        int n = (int)(ia.ephem.size() + ib.ephem.size());
+        for (const SGInfo* info : {&ia, &ib})
+            for (int t : info->out_bd) {
+                if (p.is_graph_out[t]) continue;
+                bool inside = true;
+                for (int c : p.consumers(t))
+                    if (op_to_sg[c] != a && op_to_sg[c] != b) { inside = false; break; }
+                n += inside;
             }
-            sgs[best_a].gran = best_gran;
-            sgs[best_a].latency = best_lat;
-            sgs[best_b].active = false;
-            sgs[best_b].ops.clear();
-            changed = true;
+        return n;
+    }
+
+    // run_phase for scores that need no merged cost. `key(a, b, s)` orders
+    // the heap from the parts alone, and the merged op set is scored only
+    // when the pair reaches the top, where `accept(a, b, cost)` decides.
+    // Rejected pairs never affect the others, so the merges are the ones
+    // run_phase would make, but a subgraph that grows one op at a time is
+    // scored once per merge instead of once per neighbour.
+    template <class Key, class Accept>
+    int run_phase_lazy(Key key, Accept accept) {
+        priority_queue<MergeCand> heap;
+        auto push = [&](int a, int b) {
+            double s;
+            if (key(a, b, s)) heap.push({s, a, b, sgs[a].version, sgs[b].version});
+        };
+        for (int a = 0; a < (int)sgs.size(); a++)
+            if (sgs[a].active)
+                for (int b : succ[a]) push(a, b);
+
+        int merges = 0;
+        for (int pops = 1; !heap.empty() && !out_of_time(pops); pops++) {
+            MergeCand c = heap.top();
+            heap.pop();
+            if (!sgs[c.a].active || !sgs[c.b].active) continue;
+            if (sgs[c.a].version != c.va || sgs[c.b].version != c.vb) continue;
+            if (merge_creates_cycle(c.a, c.b)) continue;
+            prefetch({{c.a, c.b}});
+            const CostEntry& e = merged_cost(c.a, c.b);
+            if (e.gran.w == 0 || !accept(c.a, c.b, e)) continue;
+
+            merge(c.a, c.b, e);
+            merges++;
+            for (int x : succ[c.a]) push(c.a, x);
+            for (int x : pred[c.a]) push(x, c.a);
         }
+        return merges;
     }
+};
 
-    // Collect active subgraphs
+// Collect active subgraphs
+vector<Subgraph> active_subgraphs(const FusionState& st) {
     vector<Subgraph> result;
-    for (auto& sg : sgs)
+    for (auto& sg : st.sgs)
         if (sg.active && !sg.ops.empty()) result.push_back(sg);
     return result;
 }
@@ -584,7 +1202,9 @@ vector<Subgraph> greedy_fusion(const Problem& p) {
 // Topological sort of subgraphs for output ordering
 // ============================================================
 
-vector<int> topo_sort_subgraphs(const vector<Subgraph>& sgs, const Problem& p) {
+// Subgraph DAG: successors of each subgraph and in-degrees
+void subgraph_dag(const vector<Subgraph>& sgs, const Problem& p,
+                  vector<set<int>>& adj, vector<int>& indeg) {
     int ns = (int)sgs.size();
     // Map each op to its subgraph index in the result vector
     int nops = (int)p.ops.size();
@@ -593,18 +1213,25 @@ vector<int> topo_sort_subgraphs(const vector<Subgraph>& sgs, const Problem& p) {
         for (int oi : sgs[si].ops)
             op_to_sg[oi] = si;
 
-    // Build subgraph adjacency
-    vector<set<int>> adj(ns);
-    vector<int> indeg(ns, 0);
+    adj.assign(ns, {});
+    indeg.assign(ns, 0);
     for (int si = 0; si < ns; si++)
         for (int oi : sgs[si].ops)
-            for (int t : p.ops[oi].outs)
-                for (int c : p.consumers[t]) {
+            for (int t : p.outs(oi))
+                for (int c : p.consumers(t)) {
                     int sj = op_to_sg[c];
                     if (sj != si && sj >= 0) adj[si].insert(sj);
                 }
     for (int si = 0; si < ns; si++)
         for (int sj : adj[si]) indeg[sj]++;
+}
+
+vector<int> topo_sort_subgraphs(const vector<Subgraph>& sgs, const Problem& p) {
+    ProfScope ps("toposort");
+    int ns = (int)sgs.size();
+    vector<set<int>> adj;
+    vector<int> indeg;
+    subgraph_dag(sgs, p, adj, indeg);
 
     queue<int> q;
     for (int i = 0; i < ns; i++)
@@ -622,7 +1249,7 @@ vector<int> topo_sort_subgraphs(const vector<Subgraph>& sgs, const Problem& p) {
 }
 
 // ============================================================
-// Zig-zag traversal & retention
+// Traversal orders & retention
 // ============================================================
 
 vector<int> gen_zigzag(int64_t tiles_x, int64_t tiles_y) {
@@ -638,160 +1265,491 @@ vector<int> gen_zigzag(int64_t tiles_x, int64_t tiles_y) {
     return order;
 }
 
-bool has_matmul(const Problem& p, const vector<int>& ops) {
-    for (int oi : ops)
-        if (p.ops[oi].type == "MatMul") return true;
-    return false;
+// Column snake: keeps RHS column strips for a whole column
+vector<int> gen_col_snake(int64_t tiles_x, int64_t tiles_y) {
+    vector<int> order;
+    for (int64_t tx = 0; tx < tiles_x; tx++)
+        for (int64_t i = 0; i < tiles_y; i++) {
+            int64_t ty = tx % 2 == 0 ? i : tiles_y - 1 - i;
+            order.push_back((int)(ty * tiles_x + tx));
+        }
+    return order;
+}
+
+// Row snake inside bands of `band` columns (cols=true) or rows. A band's
+// strips along the band fit in fast memory together, so the cross strip
+// is loaded once per band instead of once per tile.
+vector<int> gen_blocked(int64_t tiles_x, int64_t tiles_y, int64_t band, bool cols) {
+    vector<int> order;
+    int64_t outer = cols ? tiles_x : tiles_y, inner = cols ? tiles_y : tiles_x;
+    bool fwd = true;
+    for (int64_t b0 = 0; b0 < outer; b0 += band) {
+        int64_t b1 = min(outer, b0 + band);
+        for (int64_t i = 0; i < inner; i++) {
+            for (int64_t j = 0; j < b1 - b0; j++) {
+                int64_t a = fwd ? b0 + j : b1 - 1 - j;
+                int64_t tx = cols ? a : i, ty = cols ? i : a;
+                order.push_back((int)(ty * tiles_x + tx));
+            }
+            fwd = !fwd;
+        }
+    }
+    return order;
 }
 
-// 0=other, 1=LHS only, 2=RHS only, 3=both
-int matmul_role(const Problem& p, int tidx, const vector<int>& ops) {
-    int role = 0;
-    for (int oi : ops) {
-        const Op& op = p.ops[oi];
-        if (op.type == "MatMul") {
-            if (!op.ins.empty() && op.ins[0] == tidx) role |= 1;
-            if (op.ins.size() > 1 && op.ins[1] == tidx) role |= 2;
+// Space-filling curves over the enclosing power-of-two square, clipped
+vector<int> gen_curve(int64_t tiles_x, int64_t tiles_y, bool hilbert) {
+    int64_t n = 1;
+    while (n < max(tiles_x, tiles_y)) n *= 2;
+    vector<int> order;
+    for (int64_t d = 0; d < n * n; d++) {
+        int64_t x = 0, y = 0;
+        if (hilbert) {
+            for (int64_t s = 1, t = d; s < n; s *= 2, t /= 4) {
+                int64_t rx = 1 & (t / 2), ry = 1 & (t ^ rx);
+                if (ry == 0) {
+                    if (rx == 1) { x = s - 1 - x; y = s - 1 - y; }
+                    swap(x, y);
+                }
+                x += s * rx;
+                y += s * ry;
+            }
+        } else {
+            for (int b = 0; (int64_t(1) << b) < n; b++) {
+                x |= ((d >> (2 * b)) & 1) << b;
+                y |= ((d >> (2 * b + 1)) & 1) << b;
+            }
         }
+        if (x < tiles_x && y < tiles_y) order.push_back((int)(y * tiles_x + x));
     }
-    return role;
+    return order;
 }
 
-// Latency with zig-zag reuse and retention
-double calc_latency_final(const Problem& p, const vector<int>& ops,
-                          const SGInfo& info, const Gran& g,
-                          bool zigzag,
-                          const set<int>& retained_in,
-                          const set<int>& retained_out) {
+// Latency with traversal reuse and retention. retained_in / retained_out
+// are sorted tensor ids; an empty or raster `trav` reloads every input on
+// every tile.
+//
+// Reuse is over MatMul input strips (an LHS strip per tile row, an RHS
+// strip per tile column). Each such input always keeps its most recent
+// strip, as the hardware does between consecutive tiles. Under
+// StripCache::Lru fast memory left over after the working set and
+// retention holds further strips in an LRU, charged at full K extent.
+double calc_latency_final(const Problem& p, const SGInfo& info, const Gran& g,
+                          const vector<int>& trav,
+                          const vector<int>& retained_in,
+                          const vector<int>& retained_out) {
     if (info.out_W <= 0 || info.out_H <= 0) return 0;
 
+    // Resident tensors take their room before any strip is cached
+    int64_t spare = p.fast_cap - working_set(info, g) -
+                    resident_bytes(p, info, g, retained_in, retained_out);
+
+    bool reuse = !trav.empty() && !is_raster(trav);
+    if (g_model == LatencyModel::Step)
+        return StepModel(p, info, g).best_pins(reuse, retained_in, retained_out, spare).second;
+
+    auto retained = [](const vector<int>& v, int t) {
+        return binary_search(v.begin(), v.end(), t);
+    };
+
     int64_t tiles_x = (info.out_W + g.w - 1) / g.w;
     int64_t tiles_y = (info.out_H + g.h - 1) / g.h;
-    int64_t nat_scale = max(1LL, (g.w + p.nat_w - 1) / p.nat_w) *
-                        max(1LL, (g.h + p.nat_h - 1) / p.nat_h);
+    int64_t nat_scale = max((int64_t)1, (g.w + p.nat_w - 1) / p.nat_w) *
+                        max((int64_t)1, (g.h + p.nat_h - 1) / p.nat_h);
 
-    double compute = 0;
-    for (int oi : ops) compute += (double)p.ops[oi].base_cost;
-    compute *= nat_scale;
+    double compute = (double)info.compute * nat_scale;
 
     // mem_out: exclude retained outputs
     double mem_out = 0;
     for (int t : info.out_bd)
-        if (!retained_out.count(t))
+        if (!retained(retained_out, t))
             mem_out += (double)(g.w * g.h) / p.slow_bw;
 
-    // Classify boundary inputs
-    struct TIC { double mem; int role; };  // role: 1=LHS, 2=RHS, 0=other
-    vector<TIC> inputs;
-    for (int t : info.in_bd) {
-        if (retained_in.count(t)) continue;  // free
-        int r = matmul_role(p, t, ops);
-        double mem = (double)tile_mem_in(p, t, ops, g) / p.slow_bw;
-        int rc = (r == 1) ? 1 : (r == 2) ? 2 : 0;
-        inputs.push_back({mem, rc});
+    // Inputs loaded on every tile, and inputs cached as strips
+    double mem_fixed = 0;
+    struct Strips { int role; int64_t bytes; int base; };
+    vector<Strips> cached;
+    int64_t cap = g_strip_cache == StripCache::Lru ? max((int64_t)0, spare) : 0;
+    int64_t min_strip = INT64_MAX;
+    for (const InBd& b : info.in_bd) {
+        if (retained(retained_in, b.t)) continue;  // retained inputs are free
+        int role = reuse ? reuse_role(b) : 0;
+        if (role == 0) {
+            mem_fixed += (double)tile_mem_in(b, g) / p.slow_bw;
+            continue;
+        }
+        cached.push_back({role, tile_mem_in(b, g), 0});
+        min_strip = min(min_strip, cached.back().bytes);
     }
 
-    // Single tile or no zig-zag: simple model
-    if (!zigzag || (tiles_x <= 1 && tiles_y <= 1)) {
-        double mem_in = 0;
-        for (auto& tic : inputs) mem_in += tic.mem;
-        return tiles_x * tiles_y * max(compute, mem_in + mem_out);
-    }
+    if (cached.empty()) return tiles_x * tiles_y * max(compute, mem_fixed + mem_out);
 
-    // Per-tile with zig-zag reuse
     double total = 0;
-    int64_t prev_tx = -1, prev_ty = -1;
-    for (int64_t ty = 0; ty < tiles_y; ty++) {
-        bool ltr = (ty % 2 == 0);
-        for (int64_t i = 0; i < tiles_x; i++) {
-            int64_t tx = ltr ? i : (tiles_x - 1 - i);
-            double mem_in = 0;
-            for (auto& tic : inputs) {
-                bool reuse = false;
-                if (prev_tx >= 0) {
-                    if (tic.role == 1 && ty == prev_ty) reuse = true;  // LHS, same row
-                    if (tic.role == 2 && tx == prev_tx) reuse = true;  // RHS, same col
-                }
-                if (!reuse) mem_in += tic.mem;
-            }
-            total += max(compute, mem_in + mem_out);
-            prev_tx = tx;
-            prev_ty = ty;
+    if (cap < min_strip) {
+        // No room beyond each input's current strip: a tile reloads the LHS
+        // strips iff its row changed and the RHS strips iff its column did.
+        double mem_role[3] = {0, 0, 0};
+        for (const Strips& cs : cached) mem_role[cs.role] += (double)cs.bytes / p.slow_bw;
+        int64_t n[4] = {0, 0, 0, 0};
+        uint32_t px = UINT32_MAX, py = UINT32_MAX, tw = (uint32_t)tiles_x;
+        for (int tile : trav) {
+            uint32_t tx = (uint32_t)tile % tw, ty = (uint32_t)tile / tw;
+            n[(ty != py) | (tx != px) << 1]++;
+            px = tx;
+            py = ty;
         }
+        for (int c = 0; c < 4; c++)
+            if (n[c])
+                total += n[c] * max(compute, mem_fixed + mem_out + (c & 1 ? mem_role[1] : 0) +
+                                                 (c & 2 ? mem_role[2] : 0));
+        return total;
     }
-    return total;
-}
 
-void assign_traversals(vector<Subgraph>& sgs, const Problem& p) {
-    for (auto& sg : sgs) {
-        if (!has_matmul(p, sg.ops)) continue;
-        SGInfo info = analyze(p, sg.ops);
-        int64_t tiles_x = (info.out_W + sg.gran.w - 1) / sg.gran.w;
-        int64_t tiles_y = (info.out_H + sg.gran.h - 1) / sg.gran.h;
-        if (tiles_x * tiles_y > 1)
-            sg.traversal = gen_zigzag(tiles_x, tiles_y);
+    // LRU as a doubly linked list over one node per (input, strip);
+    // node n_nodes is the sentinel (head = next, tail = prev).
+    int n_nodes = 0;
+    for (Strips& cs : cached) {
+        cs.base = n_nodes;
+        n_nodes += (int)(cs.role == 1 ? tiles_y : tiles_x);
+        cap += cs.bytes;
     }
-}
-
-void assign_retention(vector<Subgraph>& sgs, const vector<int>& order, const Problem& p) {
-    int ns = (int)order.size();
-    for (int idx = 0; idx + 1 < ns; idx++) {
-        auto& sg_cur = sgs[order[idx]];
-        auto& sg_next = sgs[order[idx + 1]];
-        SGInfo info_cur = analyze(p, sg_cur.ops);
-        SGInfo info_next = analyze(p, sg_next.ops);
-
-        // Candidates: tensors produced by cur and consumed by next
-        vector<pair<int, double>> cands;
-        for (int t : info_cur.out_bd) {
-            if (!info_next.in_bd.count(t)) continue;
-            int64_t T_full = p.tensors[t].w * p.tensors[t].h;
-            int64_t extra_prod = T_full - sg_cur.gran.w * sg_cur.gran.h;
-            int64_t extra_cons = T_full - input_slice(p, t, sg_next.ops, sg_next.gran);
-            // Quick feasibility
-            int64_t ws_cur = working_set(p, sg_cur.ops, info_cur, sg_cur.gran);
-            int64_t ws_next = working_set(p, sg_next.ops, info_next, sg_next.gran);
-            if (ws_cur + extra_prod > p.fast_cap) continue;
-            if (ws_next + extra_cons > p.fast_cap) continue;
-            double benefit = (double)T_full / p.slow_bw * 2.0;
-            cands.push_back({t, benefit});
-        }
-
-        sort(cands.begin(), cands.end(), [](auto& a, auto& b) {
-            return a.second > b.second;
-        });
-
-        int64_t used_prod = 0, used_cons = 0;
-        int64_t avail_prod = p.fast_cap - working_set(p, sg_cur.ops, info_cur, sg_cur.gran);
-        int64_t avail_cons = p.fast_cap - working_set(p, sg_next.ops, info_next, sg_next.gran);
-        for (auto& [t, ben] : cands) {
-            int64_t T_full = p.tensors[t].w * p.tensors[t].h;
-            int64_t ep = T_full - sg_cur.gran.w * sg_cur.gran.h;
-            int64_t ec = T_full - input_slice(p, t, sg_next.ops, sg_next.gran);
-            if (used_prod + ep <= avail_prod && used_cons + ec <= avail_cons) {
-                sg_cur.retain.push_back(t);
-                used_prod += ep;
-                used_cons += ec;
+    vector<int> prv(n_nodes + 1, -1), nxt(n_nodes + 1, -1);  // -1: not resident
+    vector<int> owner(n_nodes);
+    for (int c = 0; c < (int)cached.size(); c++)
+        fill(owner.begin() + cached[c].base,
+             owner.begin() + cached[c].base + (cached[c].role == 1 ? tiles_y : tiles_x), c);
+    const int S = n_nodes;
+    prv[S] = nxt[S] = S;
+    auto unlink = [&](int n) {
+        nxt[prv[n]] = nxt[n];
+        prv[nxt[n]] = prv[n];
+    };
+    auto push_back = [&](int n) {
+        prv[n] = prv[S];
+        nxt[n] = S;
+        nxt[prv[S]] = n;
+        prv[S] = n;
+    };
+    int64_t used = 0;
+    const uint32_t tw = (uint32_t)tiles_x;
+    for (int tile : trav) {
+        uint32_t tx = (uint32_t)tile % tw, ty = (uint32_t)tile / tw;
+        double mem_in = mem_fixed;
+        for (Strips& cs : cached) {
+            int n = cs.base + (int)(cs.role == 1 ? ty : tx);
+            if (prv[S] == n) continue;  // already most recent
+            if (nxt[n] >= 0) {
+                unlink(n);
+            } else {
+                mem_in += (double)cs.bytes / p.slow_bw;
+                used += cs.bytes;
             }
+            push_back(n);
         }
+        while (used > cap) {
+            int n = nxt[S];
+            unlink(n);
+            prv[n] = nxt[n] = -1;
+            used -= cached[owner[n]].bytes;
+        }
+        total += max(compute, mem_in + mem_out);
     }
+    return total;
 }
 
-// ============================================================
-// Solution output
+// Candidate orders for a tiles_x × tiles_y grid. Blocked snakes use bands
+// as wide as the spare memory can cache strips across.
+//
+// When no extra strip fits, or strips are charged StripCache::Adjacent, a
+// tile only reuses strips shared with the tile before it, and one of the
+// two snakes is optimal. The curves and blocked snakes are still scored
+// there; listed after the snakes, they only win a strict improvement.
+constexpr int64_t kMaxCurveTiles = 4096;  // larger grids only try the snakes
+vector<pair<Traversal, vector<int>>> traversal_candidates(const Problem& p, const SGInfo& info,
+                                                          const Gran& g) {
+    int64_t tiles_x = (info.out_W + g.w - 1) / g.w;
+    int64_t tiles_y = (info.out_H + g.h - 1) / g.h;
+    vector<pair<Traversal, vector<int>>> out;
+    out.push_back({Traversal::RowSnake, gen_zigzag(tiles_x, tiles_y)});
+    out.push_back({Traversal::ColSnake, gen_col_snake(tiles_x, tiles_y)});
+
+    int64_t spare = p.fast_cap - working_set(info, g);
+    int64_t lhs = 0, rhs = 0;
+    for (const InBd& b : info.in_bd) {
+        int role = reuse_role(b);
+        if (role == 0) continue;
+        (role == 1 ? lhs : rhs) += tile_mem_in(b, g);
+    }
+    if (tiles_x * tiles_y > kMaxCurveTiles) return out;
+    int64_t n = 1;
+    while (n < max(tiles_x, tiles_y)) n *= 2;
+    if (n * n <= 4 * tiles_x * tiles_y) {  // curves degenerate on thin grids
+        out.push_back({Traversal::Hilbert, gen_curve(tiles_x, tiles_y, true)});
+        out.push_back({Traversal::Morton, gen_curve(tiles_x, tiles_y, false)});
+    }
+    if (rhs > 0) {
+        int64_t band = 1 + spare / rhs;
+        if (band > 1 && band < tiles_x)
+            out.push_back({Traversal::BlockCol, gen_blocked(tiles_x, tiles_y, band, true)});
+    }
+    if (lhs > 0) {
+        int64_t band = 1 + spare / lhs;
+        if (band > 1 && band < tiles_y)
+            out.push_back({Traversal::BlockRow, gen_blocked(tiles_x, tiles_y, band, false)});
+    }
+    return out;
+}
+
+// Cheapest order for the subgraph, scored without retention; returns its
+// latency. Ties keep the earlier candidate, so the row snake wins when
+// nothing beats it.
+double assign_traversal(const Problem& p, Subgraph& sg, const SGInfo& info) {
+    static const vector<int> none;
+    sg.traversal.clear();
+    sg.trav_kind = Traversal::Raster;
+    int64_t tiles_x = (info.out_W + sg.gran.w - 1) / sg.gran.w;
+    int64_t tiles_y = (info.out_H + sg.gran.h - 1) / sg.gran.h;
+    // No MatMul, or a single row or column: its only snake is the raster
+    // order, which reuses nothing
+    if (info.maxK == 0 || tiles_x <= 1 || tiles_y <= 1)
+        return calc_latency_final(p, info, sg.gran, none, none, none);
+    if (g_model == LatencyModel::Step) {  // StepModel only knows the row snake
+        sg.traversal = gen_zigzag(tiles_x, tiles_y);
+        sg.trav_kind = Traversal::RowSnake;
+        return calc_latency_final(p, info, sg.gran, sg.traversal, none, none);
+    }
+    double best = 1e30;
+    for (auto& [kind, order] : traversal_candidates(p, info, sg.gran)) {
+        double lat = calc_latency_final(p, info, sg.gran, order, none, none);
+        if (lat < best - 1e-6) {
+            best = lat;
+            sg.trav_kind = kind;
+            sg.traversal = move(order);
+        }
+    }
+    return best;
+}
+
+void assign_traversals(vector<Subgraph>& sgs, const Problem& p) {
+    ProfScope ps("traversal");
+    for (auto& sg : sgs) assign_traversal(p, sg, analyze(p, sg.ops));
+}
+
+// The ops of two subgraphs, marked in a per-thread array so membership
+// is one load instead of a scan of both op lists. Only one may be alive
+// per thread at a time.
+class OpPair {
+public:
+    OpPair(const Problem& p, const Subgraph& a, const Subgraph& b) {
+        thread_local vector<uint32_t> marks;
+        thread_local uint32_t stamp = 0;
+        if (marks.size() < p.ops.size()) marks.assign(p.ops.size(), 0);
+        if (++stamp == 0) {
+            fill(marks.begin(), marks.end(), 0);
+            stamp = 1;
+        }
+        mark = &marks;
+        id = stamp;
+        for (int oi : a.ops) marks[oi] = id;
+        for (int oi : b.ops) marks[oi] = id;
+    }
+    bool has(int oi) const { return (*mark)[oi] == id; }
+
+private:
+    vector<uint32_t>* mark;
+    uint32_t id;
+};
+
+// Whether cur may keep output t for next (`both` holds their ops). A
+// retained output is never written back, so next must be its only reader
+// and it cannot be a graph output.
+bool retainable(const Problem& p, const SGInfo& info_cur, const SGInfo& info_next,
+                const OpPair& both, int t) {
+    if (p.is_graph_out[t] || !find_in_bd(info_next, t)) return false;
+    if (!binary_search(info_cur.out_bd.begin(), info_cur.out_bd.end(), t)) return false;
+    for (int c : p.consumers(t))
+        if (!both.has(c)) return false;
+    return true;
+}
+
+// Outputs of cur to keep resident for next (largest first), packed into
+// what fast memory has left on both sides: cur also holds what it received
+// (held_cur), next also holds what it keeps itself.
+vector<int> pick_retention(const Problem& p,
+                           const Subgraph& sg_cur, const SGInfo& info_cur,
+                           const vector<int>& held_cur,
+                           const Subgraph& sg_next, const SGInfo& info_next) {
+    int64_t avail_prod = p.fast_cap - working_set(info_cur, sg_cur.gran) -
+                         resident_bytes(p, info_cur, sg_cur.gran, held_cur, {});
+    int64_t avail_cons = p.fast_cap - working_set(info_next, sg_next.gran) -
+                         resident_bytes(p, info_next, sg_next.gran, {}, sg_next.retain);
+
+    vector<pair<int, int64_t>> cands;
+    OpPair both(p, sg_cur, sg_next);
+    for (int t : info_cur.out_bd)
+        if (retainable(p, info_cur, info_next, both, t))
+            cands.push_back({t, p.tensors[t].w * p.tensors[t].h});
+    sort(cands.begin(), cands.end(), [](auto& a, auto& b) {
+        return a.second > b.second;
+    });
+
+    vector<int> retain;
+    for (auto& [t, full] : cands) {
+        int64_t ep = resident_extra(p, info_cur, sg_cur.gran, t);
+        int64_t ec = resident_extra(p, info_next, sg_next.gran, t);
+        if (ep <= avail_prod && ec <= avail_cons) {
+            retain.push_back(t);
+            avail_prod -= ep;
+            avail_cons -= ec;
+        }
+    }
+    return retain;
+}
+
+vector<SGInfo> schedule_infos(const Problem& p, const vector<Subgraph>& sgs,
+                              const vector<int>& order) {
+    vector<SGInfo> raw(order.size());
+    for (int q = 0; q < (int)order.size(); q++) raw[q] = analyze(p, sgs[order[q]].ops);
+    ScheduleCtx ctx = schedule_ctx(p, raw);
+    for (int q = 0; q < (int)order.size(); q++) raw[q] = in_context(p, raw[q], q, ctx);
+    return raw;
+}
+
+void assign_retention(vector<Subgraph>& sgs, const vector<int>& order, const Problem& p) {
+    ProfScope ps("retention");
+    int ns = (int)order.size();
+    vector<SGInfo> infos = schedule_infos(p, sgs, order);
+    for (int idx = 0; idx < ns; idx++) sgs[order[idx]].retain.clear();
+    for (int idx = 0; idx + 1 < ns; idx++) {
+        auto& sg_cur = sgs[order[idx]];
+        auto& sg_next = sgs[order[idx + 1]];
+        static const vector<int> none;
+        const vector<int>& held = idx > 0 ? sgs[order[idx - 1]].retain : none;
+        sg_cur.retain = pick_retention(p, sg_cur, infos[idx], held, sg_next, infos[idx + 1]);
+    }
+}
+
+// What cur can hand next through retention when nothing else is resident:
+// the slow-memory time it saves (each tensor's write-back and reload) and
+// the fast memory it takes on both sides. next.retain must be empty.
+struct Handoff { double gain = 0; int64_t bytes = 0; };
+Handoff handoff(const Problem& p, const Subgraph& cur, const SGInfo& info_cur,
+                const Subgraph& next, const SGInfo& info_next) {
+    Handoff h;
+    for (int t : pick_retention(p, cur, info_cur, {}, next, info_next)) {
+        h.gain += 2.0 * (double)(p.tensors[t].w * p.tensors[t].h) / p.slow_bw;
+        h.bytes += resident_extra(p, info_cur, cur.gran, t) +
+                   resident_extra(p, info_next, next.gran, t);
+    }
+    return h;
+}
+
+// List scheduler over the subgraph DAG that favours retention: among the
+// ready subgraphs it runs next the one the last scheduled subgraph can hand
+// the most bytes to (what pick_retention would keep, at the 2·size/bw it
+// saves), plus the best hand-off that choice enables one step further.
+// Ties go to the larger immediate hand-off, then to the one needing fewer
+// resident bytes, then to FIFO order, so without any retention in reach
+// this is topo_sort_subgraphs.
+vector<int> retention_order(const vector<Subgraph>& sgs_in, const Problem& p) {
+    ProfScope ps("retention order");
+    int ns = (int)sgs_in.size();
+    vector<Subgraph> sgs = sgs_in;  // hand-offs are judged with nothing else retained
+    vector<SGInfo> info(ns);
+    for (int i = 0; i < ns; i++) {
+        sgs[i].retain.clear();
+        info[i] = analyze(p, sgs[i].ops);
+    }
+    vector<set<int>> adj;
+    vector<int> indeg;
+    subgraph_dag(sgs, p, adj, indeg);
+
+    unordered_map<int64_t, Handoff> memo;
+    auto pair_handoff = [&](int a, int b) -> Handoff {
+        if (a < 0) return {};
+        auto [it, fresh] = memo.try_emplace((int64_t)a * ns + b);
+        if (fresh) it->second = handoff(p, sgs[a], info[a], sgs[b], info[b]);
+        return it->second;
+    };
+
+    vector<int> ready;  // in FIFO arrival order
+    for (int i = 0; i < ns; i++)
+        if (indeg[i] == 0) ready.push_back(i);
+    vector<int> order;
+    int last = -1;
+    while (!ready.empty()) {
+        int pick = 0;
+        double best_score = -1, best_now = 0;
+        int64_t best_bytes = 0;
+        for (int r = 0; r < (int)ready.size(); r++) {
+            int u = ready[r];
+            Handoff h = pair_handoff(last, u);
+            double ahead = 0;
+            for (int v : ready)
+                if (v != u) ahead = max(ahead, pair_handoff(u, v).gain);
+            for (int v : adj[u])
+                if (indeg[v] == 1) ahead = max(ahead, pair_handoff(u, v).gain);
+            double score = h.gain + ahead;
+            bool tie = score > best_score - 1e-9;
+            if (score > best_score + 1e-9 ||
+                (tie && h.gain > best_now + 1e-9) ||
+                (tie && h.gain > best_now - 1e-9 && h.bytes < best_bytes)) {
+                pick = r;
+                best_score = score;
+                best_now = h.gain;
+                best_bytes = h.bytes;
+            }
+        }
+        int u = ready[pick];
+        ready.erase(ready.begin() + pick);
+        order.push_back(u);
+        for (int v : adj[u])
+            if (--indeg[v] == 0) ready.push_back(v);
+        last = u;
+    }
+    return order;
+}
+
+// ============================================================
+// Schedule evaluation (final model: zig-zag + retention)
 // ============================================================
 
-void write_solution(const char* path, const vector<Subgraph>& sgs,
-                    const vector<int>& order, const Problem& p) {
-    ofstream f(path);
-    if (!f) { cerr << "Cannot write " << path << endl; exit(1); }
+// Latency of the subgraph at schedule position i, whose boundary in the
+// schedule is `info`. It depends on its own traversal and on what its
+// neighbours retain across each boundary.
+double position_latency(const Problem& p, const vector<Subgraph>& sgs,
+                        const vector<int>& order, int i, const SGInfo& info) {
+    const auto& sg = sgs[order[i]];
+    vector<int> r_in;
+    if (i > 0) {
+        r_in = sgs[order[i - 1]].retain;
+        sort(r_in.begin(), r_in.end());
+    }
+    vector<int> r_out = sg.retain;
+    sort(r_out.begin(), r_out.end());
+    return calc_latency_final(p, info, sg.gran, sg.traversal, r_in, r_out);
+}
+
+vector<double> schedule_latencies(const Problem& p, const vector<Subgraph>& sgs,
+                                  const vector<int>& order) {
+    vector<SGInfo> infos = schedule_infos(p, sgs, order);
+    vector<double> lats(order.size());
+    for (int i = 0; i < (int)order.size(); i++)
+        lats[i] = position_latency(p, sgs, order, i, infos[i]);
+    return lats;
+}
+
+// ============================================================
+// Solution output
+// ============================================================
 
-    // Build retained-in sets for each subgraph in schedule order
+// Returns false with a message in `err` when the file cannot be written
+bool write_solution(const char* path, const vector<Subgraph>& sgs,
+                    const vector<int>& order, const Problem& p, string& err) {
+    ProfScope ps("write");
+    ofstream f(path);
+    if (!f) { err = string("Cannot write ") + path; return false; }
     int ns = (int)order.size();
-    vector<set<int>> retained_in(ns);
-    for (int i = 0; i + 1 < ns; i++)
-        for (int t : sgs[order[i]].retain)
-            retained_in[i + 1].insert(t);
 
     f << "{\n";
 
@@ -844,74 +1802,2517 @@ void write_solution(const char* path, const vector<Subgraph>& sgs,
 
     // subgraph_latencies — computed with zig-zag + retention
     f << "  \"subgraph_latencies\": [";
-    for (int i = 0; i < ns; i++) {
-        const auto& sg = sgs[order[i]];
-        SGInfo info = analyze(p, sg.ops);
-        set<int> r_out(sg.retain.begin(), sg.retain.end());
-        bool zz = !sg.traversal.empty();
-        double lat = calc_latency_final(p, sg.ops, info, sg.gran,
-                                        zz, retained_in[i], r_out);
-        f << (i ? ", " : "") << lat;
-    }
+    vector<double> lats = schedule_latencies(p, sgs, order);
+    for (int i = 0; i < ns; i++)
+        f << (i ? ", " : "") << lats[i];
     f << "]\n";
 
     f << "}\n";
+    if (!f.flush()) { err = string("Cannot write ") + path; return false; }
+    return true;
 }
 
 // ============================================================
-// Main
+// Anytime driver — atomic output
 // ============================================================
 
-int main(int argc, char** argv) {
-    if (argc < 3) {
-        cerr << "Usage: ./mlsys <input.json> <output.json>" << endl;
-        return 1;
+// The harness kills us at the tier timeout, so an unfused schedule is
+// written before fusion starts, replaced as soon as greedy finishes and
+// rewritten whenever the search improves it.
+
+struct Schedule {
+    vector<Subgraph> sgs;
+    vector<int> order;
+    double total = 0;
+};
+
+double schedule_total(const Problem& p, const vector<Subgraph>& sgs, const vector<int>& order) {
+    double total = 0;
+    for (double lat : schedule_latencies(p, sgs, order)) total += lat;
+    return total;
+}
+
+// Order, traversals and retention for a fused partition, scored end to
+// end. Both the FIFO and the retention-aware order are tried.
+Schedule build_schedule(const Problem& p, vector<Subgraph> sgs) {
+    ProfScope ps("build schedule");
+    Schedule s;
+    s.sgs = move(sgs);
+    assign_traversals(s.sgs, p);
+    s.order = topo_sort_subgraphs(s.sgs, p);
+    assign_retention(s.sgs, s.order, p);
+    s.total = schedule_total(p, s.sgs, s.order);
+
+    vector<int> order = retention_order(s.sgs, p);
+    if (order != s.order) {
+        vector<Subgraph> sgs2 = s.sgs;
+        assign_retention(sgs2, order, p);
+        double total = schedule_total(p, sgs2, order);
+        if (total < s.total - 1e-6) {
+            s.sgs = move(sgs2);
+            s.order = move(order);
+            s.total = total;
+        }
+    }
+    return s;
+}
+
+// Write to <path>.tmp and rename over <path>, so a kill mid-write leaves the
+// previous solution intact. Non-regular targets (/dev/null) are written directly.
+bool write_solution_atomic(const char* path, const Schedule& s, const Problem& p, string& err) {
+    struct stat st;
+    if (stat(path, &st) == 0 && !S_ISREG(st.st_mode))
+        return write_solution(path, s.sgs, s.order, p, err);
+    string tmp = string(path) + ".tmp";
+    if (!write_solution(tmp.c_str(), s.sgs, s.order, p, err)) {
+        remove(tmp.c_str());
+        return false;
+    }
+    if (rename(tmp.c_str(), path) != 0) {
+        err = "Cannot rename " + tmp + " to " + path;
+        remove(tmp.c_str());
+        return false;
     }
+    return true;
+}
 
-    Problem p = read_problem(argv[1]);
+// Rewrites the output whenever the total improves, at most every
+// kMinWriteGapMs; flush() forces out the last improvement. A failed write
+// exits, unless `error` is set: then the message lands there and nothing
+// more is written.
+struct AnytimeWriter {
+    static constexpr double kMinWriteGapMs = 100;
+    const char* path;
+    const Problem& p;
+    const Deadline& dl;
+    double written_total = 1e300;
+    double last_write_ms = -1e9;
+    int writes = 0;
+    string* error = nullptr;
 
-    cerr << "Problem: " << p.tensors.size() << " tensors, "
-         << p.ops.size() << " ops, fast_cap=" << p.fast_cap
-         << " slow_bw=" << p.slow_bw << " native=[" << p.nat_w << "," << p.nat_h << "]" << endl;
+    bool failed() const { return error && !error->empty(); }
+    void offer(const Schedule& s, bool force = false) {
+        if (s.total >= written_total - 1e-9 || failed()) return;
+        double now = dl.elapsed_ms();
+        if (!force && now - last_write_ms < kMinWriteGapMs) return;
+        string err;
+        if (!write_solution_atomic(path, s, p, err)) {
+            if (!error) { cerr << err << endl; exit(1); }
+            *error = err;
+            return;
+        }
+        written_total = s.total;
+        last_write_ms = now;
+        writes++;
+    }
+    void flush(const Schedule& s) { offer(s, true); }
+    // Write s even if it is not cheaper (the written schedule was invalid)
+    void replace(const Schedule& s) {
+        written_total = 1e300;
+        offer(s, true);
+    }
+};
 
-    // Run greedy fusion
-    vector<Subgraph> sgs = greedy_fusion(p);
-    cerr << "Fusion: " << sgs.size() << " subgraphs" << endl;
+// Every (w, h) candidate of find_best_gran that fits, with its largest k
+// (with every feasible k under the step model).
+vector<Gran> feasible_grans(const Problem& p, const SGInfo& info) {
+    vector<Gran> out;
+    if (info.out_W <= 0) return out;
+    GranModel m(p, info);
+    auto ks = info.maxK > 0 ? pow2_candidates(info.maxK) : vector<int64_t>{1};
+    uint64_t rejected = 0;
+    for (int64_t w : dim_candidates(info.out_W, p.nat_w))
+        for (int64_t h : dim_candidates(info.out_H, p.nat_h)) {
+            int64_t k = max_feasible_k(m, w, h, ks, p.fast_cap);
+            if (k == 0) { rejected++; break; }
+            if (g_model == LatencyModel::Step)  // every k is a distinct schedule
+                for (int64_t kk : ks)
+                    if (kk < k) out.push_back({w, h, kk});
+            out.push_back({w, h, k});
+        }
+    prof_count(Prof::GranTried, out.size());
+    prof_count(Prof::GranCapReject, rejected);
+    return out;
+}
 
-    // Topological ordering
-    auto order = topo_sort_subgraphs(sgs, p);
 
-    // Assign zig-zag traversal for MatMul subgraphs
-    assign_traversals(sgs, p);
+// ============================================================
+// Fusion scoring (greedy phases under the final model)
+// ============================================================
 
-    // Assign retention between consecutive subgraphs
-    assign_retention(sgs, order, p);
+// Score fusion with calc_latency_final (--fusion=tile: calc_latency, as
+// before traversals and retention existed)
+bool g_fuse_final = true;
 
-    // Compute final latencies and print summary
-    int ns = (int)order.size();
-    vector<set<int>> retained_in(ns);
-    for (int i = 0; i + 1 < ns; i++)
-        for (int t : sgs[order[i]].retain)
-            retained_in[i + 1].insert(t);
+// Final-model granularity of a scored op set: the cheapest feasible [w,h,k]
+// once each has its best traversal. Starts from the calc_latency pick and
+// skips sizes whose compute floor cannot beat the best so far.
+void score_final(const Problem& p, CostEntry& e) {
+    e.final_gran = e.gran;
+    e.final_lat = e.lat;
+    // Without a MatMul there is nothing to reuse: the models agree
+    if (e.gran.w == 0 || e.info.maxK == 0) return;
+    Subgraph sg;
+    sg.gran = e.gran;
+    e.final_lat = assign_traversal(p, sg, e.info);
+    for (const Gran& g : feasible_grans(p, e.info)) {
+        if (g.w == e.gran.w && g.h == e.gran.h && g.k == e.gran.k) continue;
+        if (compute_floor(p, e.info, g) >= e.final_lat) continue;
+        sg.gran = g;
+        double lat = assign_traversal(p, sg, e.info);
+        if (lat < e.final_lat - 1e-6) {
+            e.final_lat = lat;
+            e.final_gran = g;
+        }
+    }
+}
 
-    double total = 0;
-    for (int i = 0; i < ns; i++) {
-        auto& sg = sgs[order[i]];
-        SGInfo info = analyze(p, sg.ops);
-        set<int> r_out(sg.retain.begin(), sg.retain.end());
-        bool zz = !sg.traversal.empty();
-        double lat = calc_latency_final(p, sg.ops, info, sg.gran,
-                                        zz, retained_in[i], r_out);
-        total += lat;
-        cerr << "  SG[" << i << "] ops=" << sg.ops.size()
-             << " gran=[" << sg.gran.w << "," << sg.gran.h << "," << sg.gran.k << "]"
-             << (zz ? " zigzag" : "")
-             << " retain=" << sg.retain.size()
-             << " lat=" << lat << endl;
-    }
-    cerr << "Total latency: " << total << endl;
-
-    write_solution(argv[2], sgs, order, p);
-    cerr << "Solution written to " << argv[2] << endl;
+// The step model already scores k-steps and pins in find_best_gran, and
+// only ever walks the row snake, so it keeps its own fusion scores.
+auto fusion_finish() -> void (*)(const Problem&, CostEntry&) {
+    return g_fuse_final && g_model == LatencyModel::Tile ? score_final : nullptr;
+}
+
+// Retention a merge gives up with the rest of the graph. Each subgraph has
+// one boundary on each side, so the best hand-off into {a, b} from any other
+// producer and the best one out of it to any other consumer are compared
+// with what the merged subgraph still gets; only the shortfall counts.
+// (The hand-off between a and b themselves is what fusing replaces.)
+double lost_handoffs(FusionState& st, int a, int b, const CostEntry& e) {
+    const Problem& p = st.p;
+    auto info = [&](int x) -> const SGInfo& { return st.cache.map.at(st.sgs[x].mask).info; };
+    Subgraph ab;
+    ab.ops = st.sgs[a].ops;
+    ab.ops.insert(ab.ops.end(), st.sgs[b].ops.begin(), st.sgs[b].ops.end());
+    ab.gran = st.gran_of(e);
+    double in_before = 0, in_after = 0, out_before = 0, out_after = 0;
+    for (int side : {a, b}) {
+        for (int x : st.pred[side]) {
+            if (x == a || x == b) continue;
+            in_before = max(in_before, handoff(p, st.sgs[x], info(x), st.sgs[side], info(side)).gain);
+            in_after = max(in_after, handoff(p, st.sgs[x], info(x), ab, e.info).gain);
+        }
+        for (int z : st.succ[side]) {
+            if (z == a || z == b) continue;
+            out_before = max(out_before, handoff(p, st.sgs[side], info(side), st.sgs[z], info(z)).gain);
+            out_after = max(out_after, handoff(p, ab, e.info, st.sgs[z], info(z)).gain);
+        }
+    }
+    return max(0.0, in_before - in_after) + max(0.0, out_before - out_after);
+}
+
+// Latency saved by merging consumer b into producer a, less the retention
+// the merge gives up when the state is set to charge for it.
+double merge_benefit(FusionState& st, int a, int b, const CostEntry& e) {
+    double s = (st.sgs[a].latency + st.sgs[b].latency) - st.lat_of(e);
+    if (st.finish && st.keep_handoffs) s -= lost_handoffs(st, a, b, e);
+    return s;
+}
+
+// Phase 1: merge pairs with positive latency benefit
+int merge_profitable(FusionState& st) {
+    return st.run_phase([&](int a, int b, const CostEntry& e, double& s) {
+        s = merge_benefit(st, a, b, e);
+        return s > 0;
+    });
+}
+
+// Phase 2 stops growing a subgraph past this many ops. Every merge
+// rescores the whole op set, so one subgraph swallowing a long chain (the
+// residual synthetic) made phase 2 quadratic: residual-10000 took 3.7 s
+// without the cap, 1.7 s with it. Measured, not proven, to cost nothing:
+// no 1k or 10k synthetic at bandwidth 100 or 20 came out worse with the
+// cap, and residual came out slightly better (266657894 vs 266658000).
+const int kEphemMaxOps = 256;
+
+// Phase 2: merge pairs with zero latency cost that create ephemeral tensors
+int merge_ephemeral(FusionState& st) {
+    return st.run_phase_lazy(
+        [&](int a, int b, double& s) {
+            if ((int)(st.sgs[a].ops.size() + st.sgs[b].ops.size()) > kEphemMaxOps) return false;
+            s = (double)st.merged_ephem(a, b);
+            return s > 0;
+        },
+        [&](int a, int b, const CostEntry& e) {
+            // don't merge if it increases latency
+            return merge_benefit(st, a, b, e) >= -1e-6;
+        });
+}
+
+// `shared` lets later searches on the same problem reuse the scored subgraphs.
+// With `keep_handoffs` (final model only) a merge must also pay for the
+// retention it gives up; greedy is myopic either way, so main runs both.
+// A `seed` partition is contracted before the greedy phases (warm start).
+// With a deadline `dl`, fusion returns the partition it has when it passes.
+vector<Subgraph> greedy_fusion(const Problem& p, ThreadPool* pool = nullptr,
+                               CostCache* shared = nullptr, bool keep_handoffs = false,
+                               const vector<vector<int>>* seed = nullptr,
+                               const Deadline* dl = nullptr) {
+    ProfScope ps("fusion");
+    CostCache local;
+    FusionState st(p, shared ? *shared : local, pool, fusion_finish());
+    st.keep_handoffs = keep_handoffs;
+    st.dl = dl;
+    if (seed) st.seed(*seed);
+    {
+        ProfScope ps("greedy phase 1");
+        merge_profitable(st);
+    }
+    {
+        ProfScope ps("greedy phase 2");
+        merge_ephemeral(st);
+    }
+
+    st.cache.report();
+    if (st.cut) logs() << "Fusion cut by deadline" << endl;
+#ifdef MLSYS_CHECK_REACH
+    logs() << "Reach check: " << st.reach_checks << " queries, "
+           << st.reach_mismatches << " mismatches vs BFS" << endl;
+#endif
+    return active_subgraphs(st);
+}
+
+
+// Local search: re-pick each subgraph's granularity under the final model.
+// Greedy chose it with calc_latency (raster, no retention), which misses
+// zig-zag reuse and retention room. A change at position i only affects the
+// latencies at i-1..i+1 (retention on both boundaries), so that window is
+// all that is re-costed.
+void refine_granularities(const Problem& p, Schedule& s, const Deadline& dl,
+                          AnytimeWriter& out) {
+    ProfScope ps("refine");
+    int ns = (int)s.order.size();
+    vector<SGInfo> infos = schedule_infos(p, s.sgs, s.order);
+
+    auto retain_at = [&](int i) {  // boundary i -> i+1
+        if (i < 0 || i + 1 >= ns) return;
+        vector<int> held = i > 0 ? s.sgs[s.order[i - 1]].retain : vector<int>{};
+        s.sgs[s.order[i]].retain = pick_retention(p, s.sgs[s.order[i]], infos[i], held,
+                                                  s.sgs[s.order[i + 1]], infos[i + 1]);
+    };
+    auto window = [&](int i) {
+        double lat = 0;
+        for (int j = max(0, i - 1); j <= min(ns - 1, i + 1); j++)
+            lat += position_latency(p, s.sgs, s.order, j, infos[j]);
+        return lat;
+    };
+
+    for (bool improved = true; improved && !dl.expired();) {
+        improved = false;
+        for (int i = 0; i < ns && !dl.expired(); i++) {
+            Subgraph& sg = s.sgs[s.order[i]];
+            double best = window(i);
+            Subgraph keep = sg;
+            vector<int> keep_prev = i > 0 ? s.sgs[s.order[i - 1]].retain : vector<int>{};
+            for (const Gran& g : feasible_grans(p, infos[i])) {
+                if (g.w == sg.gran.w && g.h == sg.gran.h && g.k == sg.gran.k) continue;
+                if (compute_floor(p, infos[i], g) >= best) continue;
+                Subgraph before = sg;
+                vector<int> before_prev = i > 0 ? s.sgs[s.order[i - 1]].retain : vector<int>{};
+                sg.gran = g;
+                assign_traversal(p, sg, infos[i]);
+                retain_at(i - 1);
+                retain_at(i);
+                double lat = window(i);
+                if (lat < best - 1e-6) {
+                    best = lat;
+                    keep = sg;
+                    keep_prev = i > 0 ? s.sgs[s.order[i - 1]].retain : vector<int>{};
+                    improved = true;
+                }
+                sg = before;
+                if (i > 0) s.sgs[s.order[i - 1]].retain = before_prev;
+            }
+            sg = keep;
+            if (i > 0) s.sgs[s.order[i - 1]].retain = keep_prev;
+        }
+        if (improved) {
+            s.total = schedule_total(p, s.sgs, s.order);
+            out.offer(s);
+        }
+    }
+}
+
+// ============================================================
+// Beam search fusion (--search=beam:W)
+// ============================================================
+
+// Greedy commits to the single best merge each round. The beam instead
+// keeps the W partitions with the lowest Σ subgraph latency (final model
+// unless --fusion=tile) after every phase-1 merge step. A partition reached
+// through different merge orders is kept once: its hash is the sum of its
+// subgraph mask hashes, which does not depend on the order the merges
+// happened in. OpMaskHash is itself a sum over ops, so its plain sum is the
+// same for every partition; each term is passed through a splitmix64
+// finalizer first, and states with equal hashes are only dropped when
+// their partition_labels match too.
+struct BeamState {
+    unique_ptr<FusionState> st;
+    double total;  // Σ latency of active subgraphs
+    size_t hash;   // Σ mix(OpMaskHash) of active subgraph masks
+};
+
+struct BeamStats {
+    int steps = 0;
+    int64_t expanded = 0, dups = 0;
+    bool cut = false;  // deadline hit before the beam ran dry
+};
+
+// Canonical form of a partition: every op labelled with the smallest op of
+// its subgraph, so equal partitions compare equal whatever their subgraph
+// numbering. With a, b >= 0 it labels `st` as if b were merged into a.
+static vector<int> partition_labels(const FusionState& st, int a = -1, int b = -1) {
+    int n = (int)st.op_to_sg.size();
+    vector<int> low(st.sgs.size(), INT_MAX), lab(n);
+    for (int oi = 0; oi < n; oi++) {
+        int s = st.op_to_sg[oi] == b ? a : st.op_to_sg[oi];
+        low[s] = min(low[s], oi);
+    }
+    for (int oi = 0; oi < n; oi++) lab[oi] = low[st.op_to_sg[oi] == b ? a : st.op_to_sg[oi]];
+    return lab;
+}
+
+// Returns up to `width` finished partitions (phase 1 + phase 2), best
+// Σ latency first. If the deadline cuts the beam short, only its best
+// state is finished greedily, so the result is always complete. The
+// finish runs under the same deadline: once it passes, the partitions
+// already finished are returned, or the first one as far as it got.
+vector<vector<Subgraph>> beam_fusion(const Problem& p, CostCache& cache, ThreadPool* pool,
+                                     int width, const Deadline& dl, BeamStats& stats) {
+    ProfScope ps("beam");
+    auto H = [](const OpMask& m) {
+        uint64_t z = OpMaskHash()(m) + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return (size_t)(z ^ (z >> 31));
+    };
+    vector<BeamState> beam, done;
+    {
+        FusionState root(p, cache, pool, fusion_finish());
+        double total = 0;
+        size_t hash = 0;
+        for (const Subgraph& sg : root.sgs) {
+            total += sg.latency;
+            hash += H(sg.mask);
+        }
+        beam.push_back({make_unique<FusionState>(move(root)), total, hash});
+    }
+    auto by_total = [](const BeamState& x, const BeamState& y) { return x.total < y.total; };
+
+    struct Child { double total; int parent, a, b; size_t hash; };
+    while (!beam.empty()) {
+        if (dl.expired()) { stats.cut = true; break; }
+        vector<Child> kids;
+        vector<int> nkids(beam.size(), 0);
+        vector<bool> leaf(beam.size(), true);
+        for (int pi = 0; pi < (int)beam.size() && !stats.cut; pi++) {
+            if (dl.expired()) { stats.cut = true; break; }
+            FusionState& st = *beam[pi].st;
+            vector<pair<int, int>> pairs;
+            for (int a = 0; a < (int)st.sgs.size(); a++)
+                if (st.sgs[a].active)
+                    for (int b : st.succ[a]) pairs.push_back({a, b});
+            st.prefetch(pairs);
+            for (auto [a, b] : pairs) {
+                const CostEntry& e = st.merged_cost(a, b);
+                if (e.gran.w == 0) continue;
+                double benefit = merge_benefit(st, a, b, e);
+                if (benefit <= 0 || st.merge_creates_cycle(a, b)) continue;
+                size_t h = beam[pi].hash - H(st.sgs[a].mask) - H(st.sgs[b].mask) +
+                           H(st.sgs[a].mask | st.sgs[b].mask);
+                kids.push_back({beam[pi].total - benefit, pi, a, b, h});
+                leaf[pi] = false;
+            }
+        }
+        if (stats.cut) break;  // a half-scored step is dropped
+        sort(kids.begin(), kids.end(), [](const Child& x, const Child& y) {
+            if (x.total != y.total) return x.total < y.total;
+            return tie(x.parent, x.a, x.b) < tie(y.parent, y.a, y.b);
+        });
+        vector<Child> keep;
+        vector<vector<int>> keep_lab;  // labels, computed on a hash match
+        unordered_map<size_t, vector<int>> seen;  // hash → indices into keep
+        auto labels = [&](const Child& c) {
+            return partition_labels(*beam[c.parent].st, c.a, c.b);
+        };
+        for (const Child& c : kids) {
+            if ((int)keep.size() == width) break;
+            vector<int>& same = seen[c.hash];
+            vector<int> lab;
+            if (!same.empty()) {
+                lab = labels(c);
+                bool dup = false;
+                for (int k : same) {
+                    if (keep_lab[k].empty()) keep_lab[k] = labels(keep[k]);
+                    if (keep_lab[k] == lab) { dup = true; break; }
+                }
+                if (dup) { stats.dups++; continue; }
+            }
+            same.push_back((int)keep.size());
+            keep.push_back(c);
+            keep_lab.push_back(move(lab));
+            nkids[c.parent]++;
+        }
+
+        // A parent's last surviving child takes its state instead of a copy.
+        vector<BeamState> next;
+        for (const Child& c : keep) {
+            BeamState& par = beam[c.parent];
+            if (--nkids[c.parent] == 0) next.push_back(move(par));
+            else next.push_back({make_unique<FusionState>(*par.st), 0, 0});
+            BeamState& ch = next.back();
+            ch.st->merge(c.a, c.b, ch.st->merged_cost(c.a, c.b));
+            ch.total = c.total;
+            ch.hash = c.hash;
+        }
+        for (int pi = 0; pi < (int)beam.size(); pi++)
+            if (leaf[pi]) done.push_back(move(beam[pi]));
+        stable_sort(done.begin(), done.end(), by_total);
+        if ((int)done.size() > width) done.erase(done.begin() + width, done.end());
+        stats.steps++;
+        stats.expanded += keep.size();
+        beam = move(next);
+    }
+
+    for (BeamState& b : beam) done.push_back(move(b));
+    stable_sort(done.begin(), done.end(), by_total);
+    if (stats.cut) width = 1;
+    vector<vector<Subgraph>> result;
+    unordered_map<size_t, vector<vector<int>>> seen;  // hash → labels kept
+    for (BeamState& b : done) {
+        if ((int)result.size() == width || (!result.empty() && dl.expired())) break;
+        vector<vector<int>>& same = seen[b.hash];
+        vector<int> lab = partition_labels(*b.st);
+        if (find(same.begin(), same.end(), lab) != same.end()) continue;
+        same.push_back(move(lab));
+        b.st->dl = &dl;
+        merge_profitable(*b.st);
+        merge_ephemeral(*b.st);
+        result.push_back(active_subgraphs(*b.st));
+        if (b.st->cut) {
+            stats.cut = true;
+            break;
+        }
+    }
+    return result;
+}
+
+// ============================================================
+// Exact partition search for small graphs (--exact)
+// ============================================================
+
+// Branch and bound over partitions into connected subgraphs, run in
+// schedule order: a state is the set of ops not yet scheduled, and a move
+// takes a connected set S whose producers outside S are all scheduled.
+// Two ops are linked when one reads the other's output or both read the
+// same tensor (siblings share that tensor's loads when fused).
+// The scheduled ops then stay closed under producers, which makes every
+// such S convex. A subgraph costs its final-model latency (best
+// granularity and traversal, no retention), the same score greedy uses.
+//
+// The lower bound on the remaining ops holds because a subgraph's latency,
+// Σ over tiles of max(compute, memory), is at least its total compute and at
+// least its total traffic:
+// - compute: each op pays base_cost × its output's native tile count, since
+//   the subgraph's tile grid covers at least that op's output;
+// - memory: the graph inputs the ops read must each be loaded at least
+//   once, and the graph outputs they produce must each be written once.
+//
+// States are memoised by their remaining-op bitmask, with either the exact
+// optimum or a lower bound proven by a failed search. The search stops at
+// kExactMaxNodes candidate subgraphs or at the deadline, and then the
+// caller keeps its heuristic schedule.
+constexpr int kExactAutoOps = 24;        // on by default up to this many ops
+constexpr int kExactMaxOps = 64;         // bitmask width
+constexpr int64_t kExactMaxNodes = 1 << 18;
+
+struct ExactStats {
+    int64_t states = 0, nodes = 0;
+    bool skipped = false;    // more ops than the bitmask holds
+    bool cut = false;        // budget or deadline hit: no proof
+    double greedy = 0, best = 0;  // Σ subgraph latency, no retention
+};
+
+// The search runs over `ops`, a set of at most 64 ops whose producers
+// outside the set all come first (every op, or an LNS window of the
+// schedule); bit i stands for ops[i]. Inputs from outside count as loaded
+// and outputs read outside as written back, as they are in the schedule.
+struct ExactSearch {
+    const Problem& p;
+    CostCache& cache;
+    const Deadline& dl;
+    ExactStats& stats;
+    vector<int> ops;             // local bit -> op id
+    int n;
+    uint64_t all = 0;
+    int64_t max_nodes = kExactMaxNodes;
+    vector<uint64_t> pred, nbr;  // producer ops / linked ops
+    vector<double> op_floor;     // compute floor per op
+    vector<vector<int>> reads_in, writes_out;  // tensors loaded / written per op
+
+    struct Cand { uint64_t s; double lat; };
+    struct State {
+        double value = 0;
+        bool exact = false;
+        uint64_t choice = 0;
+        bool listed = false;
+        vector<Cand> cands;
+    };
+    unordered_map<uint64_t, State> memo;
+
+    ExactSearch(const Problem& prob, CostCache& cc, vector<int> op_ids, const Deadline& d,
+                ExactStats& st)
+        : p(prob), cache(cc), dl(d), stats(st), ops(move(op_ids)), n((int)ops.size()),
+          pred(n, 0), nbr(n, 0), op_floor(n, 0), reads_in(n), writes_out(n) {
+        all = n == 64 ? ~0ULL : (1ULL << n) - 1;
+        unordered_map<int, int> local;
+        for (int i = 0; i < n; i++) local[ops[i]] = i;
+        for (int i = 0; i < n; i++) {
+            int o = ops[i];
+            for (int t : p.ins(o)) {
+                auto it = p.producer[t] >= 0 ? local.find(p.producer[t]) : local.end();
+                if (it != local.end()) {
+                    pred[i] |= 1ULL << it->second;
+                    nbr[i] |= 1ULL << it->second;
+                    nbr[it->second] |= 1ULL << i;
+                } else {
+                    reads_in[i].push_back(t);
+                }
+                for (int c : p.consumers(t)) {
+                    auto jt = local.find(c);
+                    if (jt != local.end() && jt->second != i) {
+                        nbr[i] |= 1ULL << jt->second;
+                        nbr[jt->second] |= 1ULL << i;
+                    }
+                }
+            }
+            int64_t tiles = 0;
+            for (int t : p.outs(o)) {
+                tiles = max(tiles, ((p.tensors[t].w + p.nat_w - 1) / p.nat_w) *
+                                   ((p.tensors[t].h + p.nat_h - 1) / p.nat_h));
+                bool leaves = p.is_graph_out[t];
+                for (int c : p.consumers(t)) leaves |= !local.count(c);
+                if (leaves) writes_out[i].push_back(t);
+            }
+            op_floor[i] = (double)p.ops[o].base_cost * tiles;
+        }
+    }
+
+    static vector<int> bits_of(uint64_t s) {
+        vector<int> bits;
+        for (; s; s &= s - 1) bits.push_back(__builtin_ctzll(s));
+        return bits;
+    }
+    vector<int> ops_of(uint64_t s) const {
+        vector<int> out;
+        for (int i : bits_of(s)) out.push_back(ops[i]);
+        return out;
+    }
+    uint64_t bits_for(const vector<int>& op_ids) const {
+        uint64_t s = 0;
+        for (int o : op_ids) s |= 1ULL << (find(ops.begin(), ops.end(), o) - ops.begin());
+        return s;
+    }
+
+    double lower_bound(uint64_t rem) const {
+        double compute = 0;
+        int64_t bytes = 0;
+        vector<int> seen;
+        for (int i : bits_of(rem)) {
+            compute += op_floor[i];
+            for (int t : reads_in[i])
+                if (find(seen.begin(), seen.end(), t) == seen.end()) {
+                    seen.push_back(t);
+                    bytes += p.tensors[t].w * p.tensors[t].h;
+                }
+            for (int t : writes_out[i]) bytes += p.tensors[t].w * p.tensors[t].h;
+        }
+        return max(compute, (double)bytes / p.slow_bw);
+    }
+
+    // Final-model latency of op set s (inf if no granularity fits). Most
+    // sets the search scores are never fused, so they are kept as
+    // (granularity, latency) here and in CostCache::scored rather than as
+    // full CostCache entries.
+    unordered_map<uint64_t, pair<Gran, double>> scored;
+    double cost(uint64_t s, Gran* g = nullptr) {
+        auto [it, fresh] = scored.try_emplace(s);
+        if (fresh) {
+            vector<int> sub = ops_of(s);
+            OpMask key = OpMask::of(sub);
+            auto known = cache.scored.find(key);
+            if (known != cache.scored.end() && known->second.exact) {
+                it->second = {known->second.gran, known->second.lat};
+            } else {
+                auto hit = cache.map.find(key);
+                CostEntry e;
+                if (hit != cache.map.end()) {
+                    e = hit->second;
+                } else {
+                    e.info = cache.analyze_set(p, key, sub);
+                    tie(e.gran, e.lat) = find_best_gran(p, e.info);
+                }
+                auto fin = fusion_finish();
+                if (fin && e.final_lat < 0) fin(p, e);
+                if (e.gran.w == 0) it->second = {e.gran, 1e30};
+                else if (fin) it->second = {e.final_gran, e.final_lat};
+                else it->second = {e.gran, e.lat};
+                const Gran& g = it->second.first;
+                cache.scored.insert_or_assign(
+                    key, CostCache::Scored{g, it->second.second,
+                                           g.w ? working_set(e.info, g) : 0, true});
+            }
+        }
+        if (g) *g = it->second.first;
+        return it->second.second;
+    }
+
+    // cost(s), or a bound under it carried from a larger capacity; solve()
+    // scores a candidate only when its bound does not prune it.
+    double bound(uint64_t s) {
+        if (scored.count(s)) return scored.at(s).second;
+        OpMask key = OpMask::of(ops_of(s));
+        auto known = cache.scored.find(key);
+        if (known != cache.scored.end() && !known->second.exact) return known->second.lat;
+        return cost(s);
+    }
+
+    bool out_of_budget() {
+        if (stats.nodes > max_nodes || ((stats.nodes & 255) == 0 && dl.expired()))
+            stats.cut = true;
+        return stats.cut;
+    }
+
+    // Connected sets containing `seed` and otherwise only higher ops of
+    // rem, each generated once: a branch that skips u forbids it below.
+    // `preds` are the producers of s; once one still unscheduled is
+    // forbidden, no extension of s can be ready.
+    void grow(uint64_t s, uint64_t preds, uint64_t frontier, uint64_t forbid, uint64_t rem,
+              vector<Cand>& out) {
+        uint64_t missing = preds & rem & ~s;
+        if ((missing & forbid) || out_of_budget()) return;
+        stats.nodes++;
+        if (!missing) {
+            double lat = bound(s);
+            if (lat < 1e30) out.push_back({s, lat});
+        }
+        for (uint64_t f = frontier & ~forbid; f; f &= f - 1) {
+            uint64_t u = f & -f;
+            int o = __builtin_ctzll(u);
+            grow(s | u, preds | pred[o], (frontier | nbr[o]) & rem & ~(s | u), forbid, rem, out);
+            forbid |= u;
+        }
+    }
+
+    // Optimum for rem if it is below budget; otherwise a lower bound ≥ budget.
+    double solve(uint64_t rem, double budget) {
+        if (rem == 0) return 0;
+        State& st = memo[rem];
+        if (st.exact) return st.value;
+        double lb = max(st.value, lower_bound(rem));
+        if (lb >= budget) return lb;
+        if (!st.listed) {
+            stats.states++;
+            for (int v : bits_of(rem)) {
+                uint64_t seed = 1ULL << v;
+                uint64_t below = seed - 1;
+                grow(seed, pred[v], nbr[v] & rem & ~below, below, rem, st.cands);
+                if (stats.cut) return 1e30;
+            }
+            sort(st.cands.begin(), st.cands.end(), [](const Cand& a, const Cand& b) {
+                return a.lat < b.lat;
+            });
+            st.listed = true;
+        }
+        // rem only shrinks below here, so st (stable in the map) stays put
+        double best = budget;
+        uint64_t choice = 0;
+        for (const Cand& c : st.cands) {
+            if (c.lat >= best) break;
+            uint64_t rest = rem & ~c.s;
+            if (c.lat + lower_bound(rest) >= best) continue;
+            double lat = cost(c.s);  // c.lat may be a bound
+            if (lat + lower_bound(rest) >= best) continue;
+            double room = best - lat;
+            double r = solve(rest, room);
+            if (stats.cut) return 1e30;
+            if (r < room) {  // not lat + r < best, which rounding can fake
+                best = lat + r;
+                choice = c.s;
+            }
+        }
+        if (choice) {
+            st.value = best;
+            st.exact = true;
+            st.choice = choice;
+            vector<Cand>().swap(st.cands);
+            return best;
+        }
+        st.value = max(lb, budget);
+        return st.value;
+    }
+
+    // Cheapest partition of the search's ops if it beats `current` (a
+    // partition of the same ops), else {}. Records both scores in stats.
+    vector<Subgraph> improve(const vector<Subgraph>& current) {
+        stats.greedy = 0;
+        for (const Subgraph& sg : current) stats.greedy += cost(bits_for(sg.ops));
+        stats.best = stats.greedy;
+        double v = solve(all, stats.greedy - 1e-6);
+        if (stats.cut || v >= stats.greedy - 1e-6) return {};
+        stats.best = v;
+
+        vector<Subgraph> out;
+        for (uint64_t rem = all; rem;) {
+            uint64_t s = memo.at(rem).choice;
+            Subgraph sg;
+            sg.ops = ops_of(s);
+            sg.mask = OpMask::of(sg.ops);
+            sg.latency = cost(s, &sg.gran);
+            out.push_back(move(sg));
+            rem &= ~s;
+        }
+        return out;
+    }
+};
+
+// Provably cheapest partition under the greedy score, or {} if the search
+// was cut short or found nothing better than `greedy`.
+vector<Subgraph> exact_partition(const Problem& p, CostCache& cache,
+                                 const vector<Subgraph>& greedy, const Deadline& dl,
+                                 ExactStats& stats) {
+    ProfScope ps("exact");
+    if ((int)p.ops.size() > kExactMaxOps) {
+        stats.skipped = true;
+        return {};
+    }
+    vector<int> ops((int)p.ops.size());
+    iota(ops.begin(), ops.end(), 0);
+    ExactSearch ex(p, cache, move(ops), dl, stats);
+    return ex.improve(greedy);
+}
+
+// ============================================================
+// Large-neighbourhood search (--lns=MS)
+// ============================================================
+
+// A floor under any schedule's total, by the argument ExactSearch uses for
+// its bound: all compute, or every graph input loaded once and every graph
+// output written once. Retention and recomputation cannot go below either.
+// It is not a relaxation of the scheduling problem, so the distance to it
+// says how far a schedule is from that floor, not from the optimum; only
+// reaching it proves optimality.
+double graph_floor(const Problem& p) {
+    double compute = 0;
+    int64_t bytes = 0;
+    for (int o = 0; o < (int)p.ops.size(); o++) {
+        int64_t tiles = 0;
+        for (int t : p.outs(o))
+            tiles = max(tiles, ((p.tensors[t].w + p.nat_w - 1) / p.nat_w) *
+                               ((p.tensors[t].h + p.nat_h - 1) / p.nat_h));
+        compute += (double)p.ops[o].base_cost * tiles;
+    }
+    for (int t = 0; t < (int)p.tensors.size(); t++)
+        if (p.is_graph_in[t] || p.is_graph_out[t]) bytes += p.tensors[t].w * p.tensors[t].h;
+    return max(compute, (double)bytes / p.slow_bw);
+}
+
+// Destroy-and-repair over the partition, warm-started from the current
+// schedule. A window is a run of consecutive positions holding at most
+// kLnsWindowOps ops. Everything its ops read from outside is produced
+// earlier, and everything they write is read later. So any partition of
+// the window, run in the window's slot, is a valid schedule. ExactSearch
+// re-partitions the window, costing each candidate subgraph at its own
+// best granularity with no retention, and build_schedule then re-picks
+// order, traversals and retention heuristically; only the partition is
+// searched. The result is
+// kept if the schedule total drops. Sweeps over every start position
+// repeat until one finds nothing or the time runs out. Windows start on a
+// small node budget, so a sweep reaches the whole schedule quickly; a sweep
+// that finds nothing but cut windows short doubles it.
+constexpr int kLnsWindowOps = 16;
+constexpr int64_t kLnsMinNodes = 1 << 12;  // per window, first sweeps
+constexpr int64_t kLnsMaxNodes = 1 << 16;
+
+struct LnsStats {
+    int64_t windows = 0, improved = 0, cut = 0;
+    int sweeps = 0;
+};
+
+void lns_schedule(const Problem& p, CostCache& cache, Schedule& s, const Deadline& dl,
+                  double budget_ms, AnytimeWriter& out, LnsStats& stats) {
+    ProfScope ps("lns");
+    double t0 = dl.elapsed_ms();
+    auto out_of_time = [&] { return dl.expired() || dl.elapsed_ms() - t0 >= budget_ms; };
+    Deadline window_dl = dl.share(1.0);
+    int64_t nodes = kLnsMinNodes;
+    while (!out_of_time()) {
+        bool improved = false, cut = false;
+        stats.sweeps++;
+        for (int i = 0; i < (int)s.order.size() && !out_of_time(); i++) {
+            vector<int> ops, window;
+            for (int j = i; j < (int)s.order.size(); j++) {
+                const Subgraph& sg = s.sgs[s.order[j]];
+                if (!window.empty() && (int)(ops.size() + sg.ops.size()) > kLnsWindowOps) break;
+                if ((int)(ops.size() + sg.ops.size()) > kExactMaxOps) break;
+                ops.insert(ops.end(), sg.ops.begin(), sg.ops.end());
+                window.push_back(s.order[j]);
+            }
+            if (window.empty() || ops.size() < 2) continue;
+
+            vector<Subgraph> current;
+            for (int w : window) current.push_back(s.sgs[w]);
+            ExactStats es;
+            ExactSearch ex(p, cache, ops, window_dl, es);
+            ex.max_nodes = nodes;
+            vector<Subgraph> parts = ex.improve(current);
+            stats.windows++;
+            stats.cut += es.cut;
+            cut |= es.cut;
+            if (parts.empty()) continue;
+
+            vector<Subgraph> sgs;
+            for (int k = 0; k < (int)s.sgs.size(); k++)
+                if (find(window.begin(), window.end(), k) == window.end()) sgs.push_back(s.sgs[k]);
+            for (Subgraph& sg : parts) sgs.push_back(move(sg));
+            Schedule cand = build_schedule(p, move(sgs));
+            if (cand.total < s.total - 1e-6) {
+                s = move(cand);
+                out.offer(s);
+                stats.improved++;
+                improved = true;
+            }
+        }
+        if (improved) continue;
+        if (!cut || nodes >= kLnsMaxNodes) break;
+        nodes *= 2;
+    }
+}
+
+// ============================================================
+// Simulated annealing over full schedules (--anneal=MS)
+// ============================================================
+
+// Whether cur may keep `retain` for next: every tensor retainable, and
+// fast memory fits on both sides under the same accounting as
+// pick_retention.
+bool retention_fits(const Problem& p, const Subgraph& cur, const SGInfo& info_cur,
+                    const vector<int>& held_cur,
+                    const Subgraph& next, const SGInfo& info_next,
+                    const vector<int>& retain) {
+    OpPair both(p, cur, next);
+    for (int t : retain)
+        if (!retainable(p, info_cur, info_next, both, t)) return false;
+    return working_set(info_cur, cur.gran) +
+                   resident_bytes(p, info_cur, cur.gran, held_cur, retain) <= p.fast_cap &&
+           working_set(info_next, next.gran) +
+                   resident_bytes(p, info_next, next.gran, retain, next.retain) <= p.fast_cap;
+}
+
+// Local search over partition, order, retention and granularity, scored by
+// the final model (calc_latency_final with retention). Each move edits a few
+// subgraphs and re-costs only the schedule positions whose latency can
+// change: the edited ones and their neighbours across each retention
+// boundary. Edits go through an undo journal, so a rejected move is rolled
+// back without touching the rest of the schedule.
+struct Annealer {
+    const Problem& p;
+    CostCache& cache;
+    Schedule& s;          // sgs may hold emptied entries (pos = -1)
+    vector<SGInfo> info;  // by subgraph index
+    vector<double> lat;   // by schedule position
+    vector<int> pos;      // subgraph index -> schedule position
+    vector<int> op_sg;    // op -> subgraph index
+    vector<int> rank;     // op -> topological rank
+    mt19937_64 rng{0x5eed};
+    int64_t tried = 0, accepted = 0, invalid = 0;
+
+    struct Saved { int id; Subgraph sg; SGInfo info; };
+    vector<Saved> saved;
+    vector<pair<int, int>> saved_ops;  // (op, previous subgraph)
+    vector<int> saved_order, saved_pos;
+    vector<double> saved_lat;
+    double saved_total = 0;
+    size_t saved_n = 0;
+
+    Annealer(const Problem& prob, CostCache& cc, Schedule& sched)
+        : p(prob), cache(cc), s(sched) {
+        int n = (int)p.ops.size();
+        op_sg.assign(n, -1);
+        rank.assign(n, 0);
+        vector<int> topo = topo_sort(p);
+        for (int i = 0; i < n; i++) rank[topo[i]] = i;
+        for (int i = 0; i < (int)s.sgs.size(); i++) {
+            Subgraph& sg = s.sgs[i];
+            sg.mask = OpMask::of(sg.ops);
+            for (int oi : sg.ops) op_sg[oi] = i;
+            sort(sg.retain.begin(), sg.retain.end());
+            info.push_back(analyze(p, sg.ops));
+        }
+        reindex();
+        lat.resize(s.order.size());
+        for (int q = 0; q < (int)s.order.size(); q++) lat[q] = eval(q);
+        s.total = accumulate(lat.begin(), lat.end(), 0.0);
+    }
+
+    int size() const { return (int)s.order.size(); }
+    int pick(int n) { return (int)(rng() % (uint64_t)n); }
+
+    void reindex() {
+        pos.assign(s.sgs.size(), -1);
+        for (int q = 0; q < size(); q++) pos[s.order[q]] = q;
+    }
+
+    double eval(int q) const {
+        static const vector<int> none;
+        const Subgraph& sg = s.sgs[s.order[q]];
+        const vector<int>& r_in = q > 0 ? s.sgs[s.order[q - 1]].retain : none;
+        return calc_latency_final(p, info[s.order[q]], sg.gran, sg.traversal,
+                                  r_in, sg.retain);
+    }
+
+    // ---- undo journal ----
+    void begin() {
+        saved.clear();
+        saved_ops.clear();
+        saved_order = s.order;
+        saved_pos = pos;
+        saved_lat = lat;
+        saved_total = s.total;
+        saved_n = s.sgs.size();
+    }
+    void touch(int i) {
+        if (i >= (int)saved_n) return;  // created by this move; dropped on undo
+        for (const Saved& x : saved)
+            if (x.id == i) return;
+        saved.push_back({i, s.sgs[i], info[i]});
+    }
+    void rollback() {
+        for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+            s.sgs[it->id] = move(it->sg);
+            info[it->id] = move(it->info);
+        }
+        for (auto it = saved_ops.rbegin(); it != saved_ops.rend(); ++it)
+            op_sg[it->first] = it->second;
+        s.sgs.resize(saved_n);
+        info.resize(saved_n);
+        s.order.swap(saved_order);
+        pos.swap(saved_pos);
+        lat.swap(saved_lat);
+        s.total = saved_total;
+    }
+
+    // ---- edits ----
+    // Give subgraph i a new op set, scored through the cost cache.
+    bool reshape(int i, vector<int> ops) {
+        OpMask m = OpMask::of(ops);
+        const CostEntry& e = cache.lookup(p, m, ops);
+        if (e.gran.w == 0) return false;
+        touch(i);
+        for (int oi : ops)
+            if (op_sg[oi] != i) {
+                saved_ops.push_back({oi, op_sg[oi]});
+                op_sg[oi] = i;
+            }
+        Subgraph& sg = s.sgs[i];
+        sg.ops = move(ops);
+        sg.mask = move(m);
+        sg.gran = e.gran;
+        sg.latency = e.lat;
+        info[i] = e.info;
+        assign_traversal(p, sg, info[i]);
+        return true;
+    }
+    int add_subgraph() {
+        s.sgs.emplace_back();
+        info.emplace_back();
+        pos.push_back(-1);
+        return (int)s.sgs.size() - 1;
+    }
+    void drop_position(int q) {
+        int i = s.order[q];
+        touch(i);
+        s.sgs[i].ops.clear();
+        s.sgs[i].active = false;
+        s.order.erase(s.order.begin() + q);
+        lat.erase(lat.begin() + q);
+        reindex();
+    }
+
+    // Every input of subgraph i is produced earlier and every output is
+    // consumed later.
+    bool placed_ok(int i) const {
+        int q = pos[i];
+        for (const InBd& b : info[i].in_bd) {
+            int pr = p.producer[b.t];
+            if (pr >= 0 && pos[op_sg[pr]] >= q) return false;
+        }
+        for (int t : info[i].out_bd)
+            for (int c : p.consumers(t))
+                if (op_sg[c] != i && pos[op_sg[c]] <= q) return false;
+        return true;
+    }
+
+    // Re-pick retention on both boundaries of each changed position, then
+    // re-cost every position whose latency those boundaries feed. A boundary
+    // whose retention still fits keeps it, so a set the toggle move found
+    // survives later moves next to it; only an empty or broken one is
+    // re-picked.
+    void restitch(vector<int> qs) {
+        int ns = size();
+        set<int> bounds, costs;
+        for (int q : qs) {
+            if (q < 0 || q >= ns) continue;
+            for (int b = q - 1; b <= q; b++)
+                if (b >= 0) bounds.insert(b);
+        }
+        for (int b : bounds) {
+            Subgraph& cur = s.sgs[s.order[b]];
+            touch(s.order[b]);
+            if (b + 1 < ns) {
+                int nx = s.order[b + 1];
+                static const vector<int> none;
+                const vector<int>& held = b > 0 ? s.sgs[s.order[b - 1]].retain : none;
+                if (cur.retain.empty() || !retention_fits(p, cur, info[s.order[b]], held,
+                                                          s.sgs[nx], info[nx], cur.retain)) {
+                    cur.retain = pick_retention(p, cur, info[s.order[b]], held, s.sgs[nx], info[nx]);
+                    sort(cur.retain.begin(), cur.retain.end());
+                }
+            } else {
+                cur.retain.clear();
+            }
+            costs.insert(b);
+            if (b + 1 < ns) costs.insert(b + 1);
+        }
+        for (int q : costs) lat[q] = eval(q);
+        s.total = accumulate(lat.begin(), lat.end(), 0.0);
+    }
+
+    // ---- moves (false = not applicable or invalid; caller rolls back) ----
+    // Move one op into a subgraph it exchanges a tensor with.
+    bool move_op() {
+        int o = pick((int)p.ops.size());
+        int a = op_sg[o];
+        vector<int> nb;
+        for (int t : p.ins(o)) {
+            int pr = p.producer[t];
+            if (pr >= 0 && op_sg[pr] != a) nb.push_back(op_sg[pr]);
+        }
+        for (int t : p.outs(o))
+            for (int c : p.consumers(t))
+                if (op_sg[c] != a) nb.push_back(op_sg[c]);
+        if (nb.empty()) return false;
+        int b = nb[pick((int)nb.size())];
+        vector<int> a_ops, b_ops = s.sgs[b].ops;
+        for (int oi : s.sgs[a].ops)
+            if (oi != o) a_ops.push_back(oi);
+        b_ops.push_back(o);
+        if (!reshape(b, move(b_ops))) return false;
+        if (a_ops.empty()) {
+            int qa = pos[a];
+            drop_position(qa);
+            if (!placed_ok(b)) return false;
+            restitch({pos[b], qa - 1, qa});
+        } else {
+            if (!reshape(a, move(a_ops))) return false;
+            if (!placed_ok(a) || !placed_ok(b)) return false;
+            restitch({pos[a], pos[b]});
+        }
+        return true;
+    }
+    // Split a subgraph at a topological cut into two consecutive ones.
+    bool split() {
+        int q = pick(size());
+        int i = s.order[q];
+        if (s.sgs[i].ops.size() < 2) return false;
+        vector<int> ops = s.sgs[i].ops;
+        sort(ops.begin(), ops.end(), [&](int x, int y) { return rank[x] < rank[y]; });
+        size_t cut = 1 + pick((int)ops.size() - 1);
+        vector<int> head(ops.begin(), ops.begin() + cut), tail(ops.begin() + cut, ops.end());
+        int j = add_subgraph();
+        if (!reshape(i, move(head)) || !reshape(j, move(tail))) return false;
+        s.order.insert(s.order.begin() + q + 1, j);
+        lat.insert(lat.begin() + q + 1, 0.0);
+        reindex();
+        restitch({q, q + 1});
+        return true;
+    }
+    // Fuse two consecutive subgraphs (the inverse of split).
+    bool merge_next() {
+        if (size() < 2) return false;
+        int q = pick(size() - 1);
+        int i = s.order[q], j = s.order[q + 1];
+        vector<int> ops = s.sgs[i].ops;
+        ops.insert(ops.end(), s.sgs[j].ops.begin(), s.sgs[j].ops.end());
+        if (!reshape(i, move(ops))) return false;
+        drop_position(q + 1);
+        restitch({q});
+        return true;
+    }
+    // Swap two consecutive subgraphs with no tensor between them.
+    bool swap_order() {
+        if (size() < 2) return false;
+        int q = pick(size() - 1);
+        int i = s.order[q], j = s.order[q + 1];
+        for (int t : info[i].out_bd)
+            for (int c : p.consumers(t))
+                if (op_sg[c] == j) return false;
+        swap(s.order[q], s.order[q + 1]);
+        pos[i] = q + 1;
+        pos[j] = q;
+        restitch({q, q + 1});
+        return true;
+    }
+    // Add or drop one retained tensor on a boundary.
+    bool toggle_retention() {
+        if (size() < 2) return false;
+        int q = pick(size() - 1);
+        int i = s.order[q], j = s.order[q + 1];
+        vector<int> cands;
+        for (int t : info[i].out_bd)
+            if (find_in_bd(info[j], t)) cands.push_back(t);
+        if (cands.empty()) return false;
+        int t = cands[pick((int)cands.size())];
+        vector<int> r = s.sgs[i].retain;
+        auto it = lower_bound(r.begin(), r.end(), t);
+        if (it != r.end() && *it == t) r.erase(it);
+        else r.insert(it, t);
+        static const vector<int> none;
+        const vector<int>& held = q > 0 ? s.sgs[s.order[q - 1]].retain : none;
+        if (!retention_fits(p, s.sgs[i], info[i], held, s.sgs[j], info[j], r)) return false;
+        touch(i);
+        s.sgs[i].retain = move(r);
+        lat[q] = eval(q);
+        lat[q + 1] = eval(q + 1);
+        s.total = accumulate(lat.begin(), lat.end(), 0.0);
+        return true;
+    }
+    // Re-pick one subgraph's granularity among the feasible candidates.
+    bool change_gran() {
+        int q = pick(size());
+        int i = s.order[q];
+        vector<Gran> gs = feasible_grans(p, info[i]);
+        if (gs.empty()) return false;
+        Gran g = gs[pick((int)gs.size())];
+        Subgraph& sg = s.sgs[i];
+        if (g.w == sg.gran.w && g.h == sg.gran.h && g.k == sg.gran.k) return false;
+        touch(i);
+        sg.gran = g;
+        assign_traversal(p, sg, info[i]);
+        restitch({q});
+        return true;
+    }
+
+    bool step(double temp) {
+        begin();
+        double before = s.total;
+        int r = pick(100);
+        bool ok = r < 30 ? move_op()
+                : r < 40 ? split()
+                : r < 50 ? merge_next()
+                : r < 65 ? swap_order()
+                : r < 75 ? toggle_retention()
+                         : change_gran();
+        tried++;
+        if (!ok) {
+            invalid++;
+            rollback();
+            return false;
+        }
+        double delta = s.total - before;
+        if (delta <= 0 || uniform_real_distribution<double>(0, 1)(rng) < exp(-delta / temp)) {
+            accepted++;
+            return delta < 0;
+        }
+        rollback();
+        return false;
+    }
+
+    // Schedule with the emptied subgraphs dropped, in position order.
+    Schedule snapshot() const {
+        Schedule out;
+        for (int i : s.order) out.sgs.push_back(s.sgs[i]);
+        out.order.resize(out.sgs.size());
+        iota(out.order.begin(), out.order.end(), 0);
+        out.total = s.total;
+        return out;
+    }
+};
+
+// Anneal `s` for up to budget_ms (and never past dl). Temperature decays
+// geometrically with elapsed time from 2% of the mean position latency to
+// a thousandth of that. Keeps the best schedule seen; s is replaced only if
+// it improved.
+void anneal_schedule(const Problem& p, CostCache& cache, Schedule& s, const Deadline& dl,
+                     double budget_ms, AnytimeWriter& out) {
+    ProfScope ps("anneal");
+    if (s.order.empty()) return;
+    Schedule work = s;
+    Annealer an(p, cache, work);
+    double t0 = dl.elapsed_ms();
+    double temp0 = 0.02 * work.total / an.size(), temp = temp0;
+    double best_total = s.total;
+    for (int64_t it = 0;; it++) {
+        if ((it & 31) == 0) {
+            double frac = (dl.elapsed_ms() - t0) / budget_ms;
+            if (frac >= 1 || dl.expired()) break;
+            temp = temp0 * pow(1e-3, frac);
+        }
+        if (an.step(temp) && work.total < best_total - 1e-6) {
+            best_total = work.total;
+            s = an.snapshot();
+            out.offer(s);
+        }
+    }
+    logs() << "Anneal: " << an.tried << " moves, " << an.accepted << " accepted, "
+           << an.invalid << " invalid (" << dl.elapsed_ms() - t0 << " ms)" << endl;
+}
+
+// ============================================================
+// Recomputation of cheap producers
+// ============================================================
+
+// Clones Pointwise producer chains into the subgraphs that read their
+// output, so the output no longer round-trips through slow memory
+// (PROBLEM.md Example 3). A clone's base_cost joins each reader's compute,
+// so the model charges it on every tile. A clone is kept only if the
+// schedule total drops. Evaluation is local: only the positions whose ops
+// or boundary changed are re-costed, plus their retention neighbours.
+struct Recomputer {
+    static constexpr int kMaxChain = 4;  // producers cloned per candidate
+    const Problem& p;
+    Schedule& s;                 // normalized: order is the identity
+    vector<SGInfo> raw;          // analyze() per position
+    vector<SGInfo> info;         // in schedule context
+    ScheduleCtx ctx;
+    vector<vector<int>> op_pos;  // op -> sorted positions holding a copy
+    vector<double> lat;
+    int64_t tried = 0, kept = 0;
+
+    struct Saved { int q; Subgraph sg; SGInfo raw, info; };
+    vector<Saved> saved;
+    vector<pair<int, vector<int>>> saved_op_pos;
+    ScheduleCtx saved_ctx;
+    vector<double> saved_lat;
+    double saved_total = 0;
+
+    Recomputer(const Problem& prob, Schedule& sched) : p(prob), s(sched) {
+        vector<Subgraph> sgs;
+        for (int i : s.order) sgs.push_back(move(s.sgs[i]));
+        s.sgs = move(sgs);
+        iota(s.order.begin(), s.order.end(), 0);
+        int ns = (int)s.order.size();
+        op_pos.resize(p.ops.size());
+        for (int q = 0; q < ns; q++) {
+            raw.push_back(analyze(p, s.sgs[q].ops));
+            for (int oi : s.sgs[q].ops) op_pos[oi].push_back(q);
+        }
+        ctx = schedule_ctx(p, raw);
+        for (int q = 0; q < ns; q++) info.push_back(in_context(p, raw[q], q, ctx));
+        lat.resize(ns);
+        for (int q = 0; q < ns; q++) lat[q] = position_latency(p, s.sgs, s.order, q, info[q]);
+        s.total = accumulate(lat.begin(), lat.end(), 0.0);
+    }
+
+    int size() const { return (int)s.order.size(); }
+    bool holds(int q, int oi) const {
+        return binary_search(op_pos[oi].begin(), op_pos[oi].end(), q);
+    }
+
+    void begin() {
+        saved.clear();
+        saved_op_pos.clear();
+        saved_ctx = ctx;
+        saved_lat = lat;
+        saved_total = s.total;
+    }
+    void touch(int q) {
+        for (const Saved& x : saved)
+            if (x.q == q) return;
+        saved.push_back({q, s.sgs[q], raw[q], info[q]});
+    }
+    void rollback() {
+        for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+            s.sgs[it->q] = move(it->sg);
+            raw[it->q] = move(it->raw);
+            info[it->q] = move(it->info);
+        }
+        for (auto it = saved_op_pos.rbegin(); it != saved_op_pos.rend(); ++it)
+            op_pos[it->first] = move(it->second);
+        ctx = move(saved_ctx);
+        lat.swap(saved_lat);
+        s.total = saved_total;
+    }
+    void set_ops(int q, vector<int> ops) {
+        touch(q);
+        for (int oi : s.sgs[q].ops) saved_op_pos.push_back({oi, op_pos[oi]});
+        for (int oi : ops) saved_op_pos.push_back({oi, op_pos[oi]});
+        for (int oi : s.sgs[q].ops) {
+            auto& v = op_pos[oi];
+            v.erase(lower_bound(v.begin(), v.end(), q));
+        }
+        for (int oi : ops) {
+            auto& v = op_pos[oi];
+            v.insert(lower_bound(v.begin(), v.end(), q), q);
+        }
+        for (const InBd& b : raw[q].in_bd) ctx.readers[b.t]--;
+        s.sgs[q].ops = move(ops);
+        raw[q] = analyze(p, s.sgs[q].ops);
+        for (const InBd& b : raw[q].in_bd) ctx.readers[b.t]++;
+    }
+
+    // Fast memory is sized for every output with an outside consumer, written
+    // back or not (as verify checks it); latency is scored in context.
+    Gran pick_gran(int q) const {
+        if (raw[q].out_W <= 0) return {1, 1, 1};
+        Gran best{0, 0, 0};
+        double best_lat = 1e30;
+        for (const Gran& g : feasible_grans(p, raw[q])) {
+            double l = calc_latency(p, info[q], g);
+            if (l < best_lat) {
+                best_lat = l;
+                best = g;
+            }
+        }
+        return best;
+    }
+
+    // The producer of t plus up to depth-1 levels of Pointwise producers
+    // that live in the same subgraph q.
+    vector<int> chain(int q, int t, int depth) const {
+        vector<int> c = {p.producer[t]};
+        for (int d = 1; d < depth; d++) {
+            size_t n = c.size();
+            for (size_t i = 0; i < n; i++)
+                for (int u : p.ins(c[i])) {
+                    int pr = p.producer[u];
+                    if (pr >= 0 && p.ops[pr].kind == OpKind::Pointwise && holds(q, pr) &&
+                        find(c.begin(), c.end(), pr) == c.end())
+                        c.push_back(pr);
+                }
+            if (c.size() == n) break;
+        }
+        return c;
+    }
+
+    // Clone `clone` (produced at q) into every subgraph reading t from slow
+    // memory and drop it from q where nothing there still needs it.
+    // Transactional: opens a fresh journal, and if the result is not a valid
+    // schedule, rolls it back and returns false with nothing changed. On
+    // success the journal stays open, so rollback() still undoes the clone.
+    bool apply(int q, int t, const vector<int>& clone) {
+        begin();
+        if (clone_into_readers(q, t, clone)) return true;
+        rollback();
+        return false;
+    }
+
+private:
+    bool clone_into_readers(int q, int t, const vector<int>& clone) {
+        int ns = size();
+        vector<int> readers;
+        for (int r = q + 1; r < ns && (int)readers.size() < ctx.readers[t]; r++)
+            if (find_in_bd(raw[r], t)) readers.push_back(r);
+        if (readers.empty()) return false;
+
+        vector<int> prods;  // tensors whose writer may move
+        for (int y : clone)
+            for (int u : p.outs(y)) prods.push_back(u);
+        vector<int> old_first;
+        for (int u : prods) old_first.push_back(ctx.first_prod[u]);
+        vector<int> changed = readers;
+        for (int r : readers) {
+            vector<int> ops = s.sgs[r].ops;
+            for (int y : clone)
+                if (!holds(r, y)) ops.push_back(y);
+            set_ops(r, move(ops));
+        }
+
+        // A clone leaves q once each of its outputs is consumed only by
+        // subgraphs that now hold their own copy (or by other leaving ops).
+        vector<int> leave = clone;
+        for (bool shrunk = true; shrunk;) {
+            shrunk = false;
+            for (size_t i = 0; i < leave.size(); i++) {
+                bool needed = false;
+                for (int u : p.outs(leave[i])) {
+                    if (p.is_graph_out[u]) needed = true;
+                    for (int c : p.consumers(u)) {
+                        bool leaving = find(leave.begin(), leave.end(), c) != leave.end();
+                        if (holds(q, c) ? !leaving
+                                        : !all_of(op_pos[c].begin(), op_pos[c].end(),
+                                                  [&](int r) { return r == q || holds(r, leave[i]); }))
+                            needed = true;
+                    }
+                }
+                if (needed) {
+                    leave.erase(leave.begin() + i);
+                    shrunk = true;
+                    break;
+                }
+            }
+        }
+        if (!leave.empty()) {  // q may end up empty; dropped when done
+            vector<int> ops;
+            for (int oi : s.sgs[q].ops)
+                if (find(leave.begin(), leave.end(), oi) == leave.end()) ops.push_back(oi);
+            set_ops(q, move(ops));
+            changed.push_back(q);
+        }
+
+        // The first copy writes; every reader must come after the last copy,
+        // which is the order verify checks.
+        set<int> ctx_pos(changed.begin(), changed.end());
+        for (size_t i = 0; i < prods.size(); i++) {
+            int u = prods[i];
+            auto& v = op_pos[p.producer[u]];
+            ctx.first_prod[u] = v.empty() ? INT_MAX : v.front();
+            if (old_first[i] != INT_MAX) ctx_pos.insert(old_first[i]);
+            if (ctx.first_prod[u] != INT_MAX) ctx_pos.insert(ctx.first_prod[u]);
+            if (ctx.readers[u] > 0)
+                for (int r = 0; r <= min(v.empty() ? ns - 1 : v.back(), ns - 1); r++)
+                    if (find_in_bd(raw[r], u)) return false;
+        }
+        for (int r : changed)
+            for (const InBd& b : raw[r].in_bd) {
+                int pr = p.producer[b.t];
+                if (pr >= 0 && (op_pos[pr].empty() || op_pos[pr].back() >= r)) return false;
+                // the writer of a newly read tensor gains an output
+                if (ctx.first_prod[b.t] != INT_MAX) ctx_pos.insert(ctx.first_prod[b.t]);
+            }
+
+        for (int c : ctx_pos) {
+            touch(c);
+            info[c] = in_context(p, raw[c], c, ctx);
+            Subgraph& sg = s.sgs[c];
+            bool reshaped = find(changed.begin(), changed.end(), c) != changed.end();
+            if (reshaped || working_set(raw[c], sg.gran) > p.fast_cap) {
+                sg.gran = pick_gran(c);
+                if (sg.gran.w == 0) return false;
+            }
+            assign_traversal(p, sg, info[c]);
+        }
+
+        set<int> bounds, costs;
+        for (int c : ctx_pos)
+            for (int b = c - 1; b <= c; b++)
+                if (b >= 0 && b < ns) bounds.insert(b);
+        for (int b : bounds) {
+            touch(b);
+            vector<int> held = b > 0 ? s.sgs[b - 1].retain : vector<int>{};
+            // raw boundaries: verify sizes fast memory without recompute context
+            s.sgs[b].retain = b + 1 < ns ? pick_retention(p, s.sgs[b], raw[b], held,
+                                                          s.sgs[b + 1], raw[b + 1])
+                                         : vector<int>{};
+            costs.insert(b);
+            if (b + 1 < ns) costs.insert(b + 1);
+        }
+        for (int c : costs) lat[c] = position_latency(p, s.sgs, s.order, c, info[c]);
+        s.total = accumulate(lat.begin(), lat.end(), 0.0);
+        return true;
+    }
+};
+
+// Try every written-back Pointwise output, cloning chains of 1..kMaxChain
+// producers, and keep the best improving clone until nothing improves.
+void recompute_producers(const Problem& p, Schedule& s, const Deadline& dl,
+                         AnytimeWriter& out) {
+    ProfScope ps("recompute");
+    if (s.order.empty()) return;
+    Recomputer rc(p, s);
+    for (bool improved = true; improved && !dl.expired();) {
+        improved = false;
+        for (int q = 0; q < rc.size() && !dl.expired(); q++) {
+            vector<int> outs = rc.info[q].out_bd;
+            for (int t : outs) {
+                int x = p.producer[t];
+                if (p.is_graph_out[t] || x < 0 || p.ops[x].kind != OpKind::Pointwise) continue;
+                if (!binary_search(rc.info[q].out_bd.begin(), rc.info[q].out_bd.end(), t))
+                    continue;
+                vector<int> best_clone;
+                double best = s.total - 1e-6;
+                size_t prev = 0;
+                for (int d = 1; d <= Recomputer::kMaxChain; d++) {
+                    vector<int> c = rc.chain(q, t, d);
+                    if (c.size() == prev) break;
+                    prev = c.size();
+                    rc.tried++;
+                    if (!rc.apply(q, t, c)) continue;
+                    if (s.total < best) {
+                        best = s.total;
+                        best_clone = c;
+                    }
+                    rc.rollback();
+                }
+                if (best_clone.empty()) continue;
+                rc.apply(q, t, best_clone);
+                rc.kept++;
+                improved = true;
+                out.offer(s);
+            }
+        }
+    }
+    if (rc.kept) {
+        Schedule packed;
+        for (Subgraph& sg : s.sgs)
+            if (!sg.ops.empty()) packed.sgs.push_back(move(sg));
+        packed.order.resize(packed.sgs.size());
+        iota(packed.order.begin(), packed.order.end(), 0);
+        assign_retention(packed.sgs, packed.order, p);
+        packed.total = schedule_total(p, packed.sgs, packed.order);
+        s = move(packed);
+    }
+    logs() << "Recompute: " << rc.kept << " clones kept of " << rc.tried << " tried" << endl;
+}
+
+// ============================================================
+// Global retention planning
+// ============================================================
+
+// The rules verify checks for tensors_to_retain: a subgraph retains only
+// what it produced, loaded or already held; resident tensors fit beside
+// the raw working set; and a retained output, which is never written back,
+// is not read from slow memory later and is not a graph output.
+bool retention_valid(const Problem& p, const Schedule& s) {
+    vector<uint8_t> resident(p.tensors.size(), 0), unwritten(p.tensors.size(), 0);
+    vector<int> held;
+    for (int q = 0; q < (int)s.order.size(); q++) {
+        const Subgraph& sg = s.sgs[s.order[q]];
+        SGInfo raw = analyze(p, sg.ops);
+        for (const InBd& b : raw.in_bd)
+            if (!resident[b.t] && unwritten[b.t]) return false;
+        // PROBLEM.md: retain[k] lists outputs or loaded inputs of SG k, so
+        // a tensor cannot ride through a subgraph that never touches it
+        for (int t : sg.retain) {
+            bool made = binary_search(raw.out_bd.begin(), raw.out_bd.end(), t) ||
+                        binary_search(raw.ephem.begin(), raw.ephem.end(), t);
+            if (!made && !find_in_bd(raw, t)) return false;
+        }
+        if (working_set(raw, sg.gran) + resident_bytes(p, raw, sg.gran, held, sg.retain) >
+            p.fast_cap)
+            return false;
+        for (int t : held) resident[t] = 0;
+        for (int t : sg.retain) resident[t] = 1;
+        for (int t : raw.out_bd) unwritten[t] = resident[t];
+        for (int t : raw.ephem)
+            if (resident[t]) unwritten[t] = 1;
+        held = sg.retain;
+    }
+    for (int t = 0; t < (int)p.tensors.size(); t++)
+        if (unwritten[t] && p.is_graph_out[t]) return false;
+    return true;
+}
+
+// Chooses tensors_to_retain for the whole schedule at once instead of per
+// boundary. A stay keeps tensor t resident from position s, which produced
+// or loaded it, through a later reader e. Every position in between must
+// read t too, since retain[k] may only list SG k's outputs and inputs
+// (PROBLEM.md); a multi-hop stay runs along consecutive readers.
+// At every position it spans it takes resident_extra on top of the raw
+// working set, so choosing stays is interval packing against per-position
+// capacities: a 0/1 knapsack with one capacity per position. A stay from
+// the producer skips the write-back, so it must reach the last reader.
+//
+// Each stay is valued on its own by re-costing the positions it spans.
+// Stays whose spans overlap form a cluster; each cluster is solved by
+// branch and bound, seeded with the greedy packing and capped at
+// kMaxNodes. The plan replaces the current retention when it is cheaper
+// or the current one is invalid.
+struct RetentionPlanner {
+    static constexpr int kMaxSpan = 8;         // positions a stay may cover
+    static constexpr int64_t kMaxNodes = 1 << 16;
+
+    struct Stay {
+        int t, s, e;
+        vector<int64_t> w;  // resident bytes at s..e
+        double value;
+    };
+
+    const Problem& p;
+    const Schedule& sched;
+    int ns;
+    vector<SGInfo> info, raw;  // by position: in context (latency), raw (capacity)
+    vector<int64_t> room;      // fast_cap - raw working set
+    vector<double> base;       // latency with no retention
+    vector<Stay> stays;
+    int multi_hop = 0;
+
+    RetentionPlanner(const Problem& p, const Schedule& s)
+        : p(p), sched(s), ns((int)s.order.size()) {
+        info = schedule_infos(p, s.sgs, s.order);
+        for (int q = 0; q < ns; q++) {
+            const Subgraph& sg = s.sgs[s.order[q]];
+            raw.push_back(analyze(p, sg.ops));
+            room.push_back(p.fast_cap - working_set(raw[q], sg.gran));
+            base.push_back(cost(q, {}, {}));
+        }
+    }
+
+    double cost(int q, const vector<int>& r_in, const vector<int>& r_out) const {
+        const Subgraph& sg = sched.sgs[sched.order[q]];
+        return calc_latency_final(p, info[q], sg.gran, sg.traversal, r_in, r_out);
+    }
+
+    bool makes(int q, int t) const {
+        return binary_search(raw[q].out_bd.begin(), raw[q].out_bd.end(), t) ||
+               binary_search(raw[q].ephem.begin(), raw[q].ephem.end(), t);
+    }
+
+    void add_stay(int t, int s, int e) {
+        Stay st{t, s, e, {}, 0};
+        vector<int> one{t};
+        for (int q = s; q <= e; q++) {
+            const Subgraph& sg = sched.sgs[sched.order[q]];
+            st.w.push_back(resident_extra(p, raw[q], sg.gran, t));
+            if (st.w.back() > room[q]) return;
+            static const vector<int> none;
+            st.value += base[q] - cost(q, q > s ? one : none, q < e ? one : none);
+        }
+        if (st.value <= 1e-9) return;
+        stays.push_back(move(st));
+    }
+
+    void enumerate() {
+        vector<vector<int>> readers(p.tensors.size());
+        for (int q = 0; q < ns; q++)
+            for (const InBd& b : info[q].in_bd) readers[b.t].push_back(q);
+        for (int q = 0; q < ns; q++) {
+            // From the producer: must cover every reader (no write-back), so
+            // the readers must be the positions right after it
+            for (int t : info[q].out_bd) {
+                const vector<int>& rd = readers[t];
+                if (p.is_graph_out[t] || rd.empty() || rd.front() != q + 1 ||
+                    rd.back() - q > kMaxSpan || rd.back() - rd.front() + 1 != (int)rd.size())
+                    continue;
+                bool clean = true;  // no recomputed copy in between
+                for (int m = q + 1; m < rd.back() && clean; m++) clean = !makes(m, t);
+                if (clean) add_stay(t, q, rd.back());
+            }
+            // From a load: through each run of consecutive later readers
+            for (const InBd& b : info[q].in_bd) {
+                const vector<int>& rd = readers[b.t];
+                auto it = upper_bound(rd.begin(), rd.end(), q);
+                for (int e = q + 1; it != rd.end() && *it == e && e - q <= kMaxSpan; ++it, e++) {
+                    if (makes(e, b.t)) break;
+                    add_stay(b.t, q, e);
+                }
+            }
+        }
+    }
+
+    // Branch and bound over one cluster (stay ids sorted by value)
+    struct Search {
+        const vector<Stay>& st;
+        const vector<int>& ids;
+        vector<int64_t> room;  // by position - lo
+        int lo;
+        vector<double> suffix;
+        vector<char> take, best_take;
+        double best = 0;
+        int64_t nodes = 0;
+
+        bool fits(int i) const {
+            const Stay& a = st[ids[i]];
+            for (int q = a.s; q <= a.e; q++)
+                if (a.w[q - a.s] > room[q - lo]) return false;
+            for (int j = 0; j < (int)ids.size(); j++) {  // same tensor: disjoint spans
+                const Stay& b = st[ids[j]];
+                if (take[j] && b.t == a.t && b.s <= a.e && a.s <= b.e) return false;
+            }
+            return true;
+        }
+        void place(int i, int sign) {
+            const Stay& a = st[ids[i]];
+            for (int q = a.s; q <= a.e; q++) room[q - lo] -= sign * a.w[q - a.s];
+            take[i] = sign > 0;
+        }
+        void greedy() {
+            double v = 0;
+            for (int i = 0; i < (int)ids.size(); i++)
+                if (fits(i)) {
+                    place(i, 1);
+                    v += st[ids[i]].value;
+                }
+            best = v;
+            best_take = take;
+            for (int i = 0; i < (int)ids.size(); i++)
+                if (take[i]) place(i, -1);
+        }
+        void dfs(int i, double v) {
+            if (v > best + 1e-9) {
+                best = v;
+                best_take = take;
+            }
+            if (i == (int)ids.size() || v + suffix[i] <= best + 1e-9) return;
+            if (++nodes > kMaxNodes) return;
+            if (fits(i)) {
+                place(i, 1);
+                dfs(i + 1, v + st[ids[i]].value);
+                place(i, -1);
+            }
+            dfs(i + 1, v);
+        }
+    };
+
+    // Retain lists for the chosen stays
+    vector<vector<int>> solve() {
+        enumerate();
+        vector<int> idx(stays.size());
+        iota(idx.begin(), idx.end(), 0);
+        sort(idx.begin(), idx.end(), [&](int a, int b) {
+            return stays[a].s < stays[b].s;
+        });
+        vector<vector<int>> retain(ns);
+        for (size_t i = 0; i < idx.size();) {
+            size_t j = i;
+            int lo = stays[idx[i]].s, hi = stays[idx[i]].e;
+            while (j < idx.size() && stays[idx[j]].s <= hi) hi = max(hi, stays[idx[j++]].e);
+            vector<int> ids(idx.begin() + i, idx.begin() + j);
+            sort(ids.begin(), ids.end(), [&](int a, int b) {
+                return stays[a].value > stays[b].value;
+            });
+            Search sr{stays, ids, vector<int64_t>(room.begin() + lo, room.begin() + hi + 1), lo, {}, {}, {}};
+            sr.suffix.assign(ids.size() + 1, 0);
+            for (int k = (int)ids.size() - 1; k >= 0; k--)
+                sr.suffix[k] = sr.suffix[k + 1] + stays[ids[k]].value;
+            sr.take.assign(ids.size(), 0);
+            sr.greedy();
+            sr.dfs(0, 0);
+            for (int k = 0; k < (int)ids.size(); k++) {
+                if (!sr.best_take[k]) continue;
+                const Stay& a = stays[ids[k]];
+                for (int q = a.s; q < a.e; q++) retain[q].push_back(a.t);
+                if (a.e - a.s > 1) multi_hop++;
+            }
+            i = j;
+        }
+        for (auto& r : retain) sort(r.begin(), r.end());
+        return retain;
+    }
+};
+
+// Replan retention over the whole schedule and keep the cheaper of the
+// plan and the current retention among those that are valid. If neither
+// is, retention is dropped, which is always valid.
+bool plan_retention(const Problem& p, Schedule& s) {
+    ProfScope ps("retention plan");
+    RetentionPlanner rp(p, s);
+    vector<vector<int>> retain = rp.solve();
+    Schedule planned = s;
+    for (int q = 0; q < rp.ns; q++) planned.sgs[planned.order[q]].retain = retain[q];
+    planned.total = schedule_total(p, planned.sgs, planned.order);
+    bool valid = retention_valid(p, s), planned_valid = retention_valid(p, planned);
+    logs() << "Retention plan: " << rp.stays.size() << " stays considered, " << rp.multi_hop
+           << " multi-hop kept, latency " << planned.total << (planned_valid ? "" : " (invalid)")
+           << " (was " << s.total << (valid ? "" : ", invalid") << ")" << endl;
+    if (valid && (!planned_valid || planned.total >= s.total - 1e-6)) return false;
+    if (!planned_valid) {
+        for (Subgraph& sg : planned.sgs) sg.retain.clear();
+        planned.total = schedule_total(p, planned.sgs, planned.order);
+    }
+    s = move(planned);
+    return true;
+}
+
+// ============================================================
+// Micro-benchmark: analyze + working-set/latency throughput
+// ============================================================
+
+// Scores every single op and every fused subgraph over a fixed pow2 (w, h)
+// grid, 20 rounds. Reports analyze calls and cost evaluations per second.
+void bench_analyze(const Problem& p) {
+    vector<vector<int>> sets;
+    for (int i = 0; i < (int)p.ops.size(); i++) sets.push_back({i});
+    for (auto& sg : greedy_fusion(p)) sets.push_back(sg.ops);
+    auto cand = pow2_candidates(4096);
+
+    const int rounds = 20;
+    int64_t evals = 0;
+    double sink = 0;
+    SGInfo info;
+    auto t0 = chrono::steady_clock::now();
+    for (int it = 0; it < rounds; it++)
+        for (auto& ops : sets) {
+            analyze(p, ops, info);
+            for (int64_t w : cand)
+                for (int64_t h : cand) {
+                    Gran g{w, h, 32};
+                    if (working_set(info, g) <= p.fast_cap) sink += calc_latency(p, info, g);
+                    evals++;
+                }
+        }
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    cerr << "bench-analyze: " << rounds * sets.size() << " analyze, " << evals
+         << " cost evals in " << sec * 1e3 << " ms (" << evals / sec / 1e6
+         << " M evals/s, checksum " << sink << ")" << endl;
+}
+
+// ============================================================
+// Solve pipeline
+// ============================================================
+
+struct SolveOptions {
+    int threads = 1;
+    int beam_width = 0;  // 0 = greedy only
+    double anneal_ms = 0;
+    double lns_ms = 0;
+    bool recompute = false;  // --recompute: no measured win yet, so off
+    int exact = 0;  // -1 off, 0 auto (≤ kExactAutoOps ops), 1 on
+    bool warm_only = false;  // seeded greedy runs skip their cold twin
+};
+
+// Warm start for solve() from an earlier solve of the same graph (a sweep
+// point). Each greedy variant is seeded with the partition that variant
+// itself reached there: one seed for both locks the hand-off-charged run
+// into the plain run's groups.
+struct WarmStart {
+    CostCache* cache = nullptr;             // already valid for the problem
+    vector<vector<int>> plain, handoffs;    // in: seeds, empty = cold
+    vector<vector<int>> out_plain, out_handoffs;  // out: this solve's greedy partitions
+};
+
+// Fusion, the optional searches, recomputation and the retention plan.
+// Every improvement is written to out_path as it is found, and the
+// returned schedule is the one on disk. `shared` (may be null) lends
+// analyze() results from other problems with the same graph; `warm` (may
+// be null) brings a cost cache and greedy seeds, and receives this solve's
+// greedy partitions. A failed write exits, or with `write_error` set,
+// ends the solve with the message there and an empty schedule.
+Schedule solve(const Problem& p, const char* out_path, const SolveOptions& o,
+               const Deadline& dl, ThreadPool& pool, SharedAnalysis* shared,
+               string* write_error = nullptr, WarmStart* warm = nullptr) {
+    logs() << "Problem: " << p.tensors.size() << " tensors, "
+           << p.ops.size() << " ops, fast_cap=" << p.fast_cap
+           << " slow_bw=" << p.slow_bw << " native=[" << p.nat_w << "," << p.nat_h << "]" << endl;
+
+    // Every op on its own goes to disk first, so a kill during fusion on a
+    // large graph still finds a valid schedule
+    AnytimeWriter out{out_path, p, dl};
+    out.error = write_error;
+    {
+        vector<Subgraph> singles(p.ops.size());
+        bool feasible = true;
+        for (int i = 0; i < (int)p.ops.size() && feasible; i++) {
+            singles[i].ops = {i};
+            singles[i].gran = find_best_gran(p, analyze(p, singles[i].ops)).first;
+            feasible = singles[i].gran.w > 0;
+        }
+        if (feasible) {
+            out.flush(build_schedule(p, move(singles)));
+            if (out.failed()) return {};
+            logs() << "Unfused schedule: " << out.written_total << " (" << dl.elapsed_ms()
+                   << " ms)" << endl;
+        }
+    }
+
+    // Run greedy fusion
+    WarmStart cold;
+    WarmStart& ws = warm ? *warm : cold;
+    CostCache fresh;
+    CostCache& cache = ws.cache ? *ws.cache : fresh;
+    cache.shared = shared;
+    auto seed = [](const vector<vector<int>>& groups) { return groups.empty() ? nullptr : &groups; };
+    auto groups_of = [](const Schedule& s) {
+        vector<vector<int>> groups;
+        for (const Subgraph& sg : s.sgs) groups.push_back(sg.ops);
+        return groups;
+    };
+    // Each op labelled with the smallest op of its subgraph: equal for equal
+    // partitions, whatever the subgraph order
+    auto labels = [&](const vector<Subgraph>& sgs) {
+        vector<int> lab(p.ops.size());
+        for (const Subgraph& sg : sgs) {
+            int low = *min_element(sg.ops.begin(), sg.ops.end());
+            for (int o : sg.ops) lab[o] = low;
+        }
+        return lab;
+    };
+    // One greedy variant, seeded when the warm start has a seed for it. A
+    // seed can lock in groups that fusing from scratch would not make (B-13
+    // sweep points up to 1.9% worse), so unless o.warm_only the variant
+    // also runs cold and keeps the better. With a carried cache the cold
+    // run is mostly lookups, and a cold partition equal to the seeded one
+    // is not scheduled again.
+    auto fuse = [&](bool keep_handoffs, const vector<vector<int>>& from) {
+        vector<Subgraph> sgs = greedy_fusion(p, &pool, &cache, keep_handoffs, seed(from), &dl);
+        vector<int> seeded = from.empty() ? vector<int>{} : labels(sgs);
+        Schedule s = build_schedule(p, move(sgs));
+        if (!from.empty() && !o.warm_only && !dl.expired()) {
+            vector<Subgraph> cold_sgs =
+                greedy_fusion(p, &pool, &cache, keep_handoffs, nullptr, &dl);
+            if (labels(cold_sgs) == seeded) return s;
+            Schedule c = build_schedule(p, move(cold_sgs));
+            logs() << "Cold " << (keep_handoffs ? "retention-aware " : "") << "fusion: "
+                   << c.total << " vs seeded " << s.total << endl;
+            if (c.total < s.total - 1e-6) s = move(c);
+        }
+        return s;
+    };
+    double t_fuse = dl.elapsed_ms();
+    Schedule best = fuse(false, ws.plain);
+    logs() << "Fusion: " << best.sgs.size() << " subgraphs (" << dl.elapsed_ms() - t_fuse
+           << " ms, " << pool.size() << " threads)" << endl;
+
+    // Greedy result replaces it before any deeper search
+    ws.out_plain = groups_of(best);
+    out.replace(best);
+    if (out.failed()) return {};
+    if (fusion_finish() && !dl.expired()) {
+        Schedule s = fuse(true, ws.handoffs);
+        ws.out_handoffs = groups_of(s);
+        logs() << "Retention-aware fusion: " << s.sgs.size() << " subgraphs, "
+               << s.total << " vs " << best.total << endl;
+        if (s.total < best.total - 1e-6) {
+            best = move(s);
+            out.offer(best);
+        }
+    }
+    double greedy_total = best.total;
+    logs() << "Greedy latency: " << greedy_total << " (" << dl.elapsed_ms() << " ms)" << endl;
+
+    if (o.exact > 0 || (o.exact == 0 && (int)p.ops.size() <= kExactAutoOps)) {
+        double t_exact = dl.elapsed_ms();
+        ExactStats es;
+        vector<Subgraph> sgs = exact_partition(p, cache, best.sgs, dl.share(0.5), es);
+        if (es.skipped)
+            logs() << "Exact search: skipped, over " << kExactMaxOps << " ops" << endl;
+        else
+            logs() << "Exact search: " << es.states << " states, " << es.nodes << " candidates, "
+                   << (es.cut ? "cut short" : sgs.empty() ? "greedy partition is optimal"
+                                                        : "optimal partition found")
+                 << " (" << es.best << " vs greedy " << es.greedy << ", "
+                 << dl.elapsed_ms() - t_exact << " ms)" << endl;
+        if (!sgs.empty()) {
+            Schedule s = build_schedule(p, move(sgs));
+            if (s.total < best.total - 1e-6) {
+                best = move(s);
+                out.offer(best);
+            }
+        }
+    }
+
+    if (o.beam_width > 0) {
+        double t_beam = dl.elapsed_ms();
+        BeamStats bs;
+        // Leave half of the remaining budget to refinement
+        for (auto& sgs : beam_fusion(p, cache, &pool, o.beam_width, dl.share(0.5), bs)) {
+            Schedule s = build_schedule(p, move(sgs));
+            if (s.total < best.total - 1e-6) {
+                best = move(s);
+                out.offer(best);
+            }
+        }
+        logs() << "Beam search (W=" << o.beam_width << "): " << bs.steps << " steps, "
+               << bs.expanded << " states, " << bs.dups << " duplicates"
+               << (bs.cut ? ", cut by deadline" : "") << "; " << best.total << " vs greedy "
+               << greedy_total << " (" << 100.0 * (greedy_total - best.total) / greedy_total
+               << "% better, " << dl.elapsed_ms() - t_beam << " ms)" << endl;
+        cache.report();
+    }
+
+    refine_granularities(p, best, dl, out);
+    out.flush(best);
+
+    // Anneal from the refined schedule, then polish its granularities. Its
+    // objective needs the order, traversals and retention build_schedule
+    // assigns, so it cannot run on the bare greedy partition.
+    if (o.anneal_ms > 0) {
+        double before = best.total;
+        anneal_schedule(p, cache, best, dl.share(0.8), o.anneal_ms, out);
+        logs() << "Anneal latency: " << best.total << " (was " << before << ")" << endl;
+        refine_granularities(p, best, dl, out);
+        out.flush(best);
+    }
+
+    if (o.lns_ms > 0) {
+        double before = best.total, t_lns = dl.elapsed_ms();
+        LnsStats ls;
+        lns_schedule(p, cache, best, dl.share(0.8), o.lns_ms, out, ls);
+        refine_granularities(p, best, dl, out);
+        out.flush(best);
+        logs() << "LNS: " << ls.sweeps << " sweeps, " << ls.windows << " windows ("
+               << ls.cut << " cut short), " << ls.improved << " improved; latency "
+               << best.total << " (was " << before << ", " << dl.elapsed_ms() - t_lns
+               << " ms)" << endl;
+    }
+
+    // Last, since the earlier stages assume each op lives in one subgraph
+    if (o.recompute) {
+        double before = best.total;
+        recompute_producers(p, best, dl, out);
+        out.flush(best);
+        logs() << "Recompute latency: " << best.total << " (was " << before << ")" << endl;
+    }
+    if (!g_stop && plan_retention(p, best)) out.replace(best);
+    if (g_stop) logs() << "Stopped by SIGTERM" << endl;
+
+    // Print summary of the best schedule
+    vector<double> lats = schedule_latencies(p, best.sgs, best.order);
+    for (int i = 0; i < (int)best.order.size(); i++) {
+        auto& sg = best.sgs[best.order[i]];
+        logs() << "  SG[" << i << "] ops=" << sg.ops.size()
+               << " gran=[" << sg.gran.w << "," << sg.gran.h << "," << sg.gran.k << "]"
+               << (sg.traversal.empty() ? "" : string(" ") + traversal_name(sg.trav_kind))
+               << " retain=" << sg.retain.size()
+               << " lat=" << lats[i] << endl;
+    }
+    logs() << "Total latency: " << best.total << endl;
+#ifdef MLSYS_CHECK_SIM
+    {
+        // Replay the final schedule through the reference simulator
+        double t_sim = dl.elapsed_ms();
+        vector<SolutionSubgraph> sol;
+        for (int i : best.order) {
+            auto& sg = best.sgs[i];
+            sol.push_back({sg.ops, sg.gran, sg.retain, sg.traversal, 0});
+        }
+        SimResult sim = simulate(p, sol,
+                                 g_model == LatencyModel::Step ? SimModel::Step : SimModel::Tile,
+                                 g_strip_cache);
+        int mismatches = 0;
+        for (int i = 0; i < (int)lats.size(); i++)
+            if (fabs(sim.lats[i] - lats[i]) > max(0.1, 1e-5 * lats[i])) {
+                mismatches++;
+                logs() << "Sim mismatch: SG[" << i << "] solver=" << lats[i]
+                       << " sim=" << sim.lats[i] << endl;
+            }
+        logs() << "Sim check: " << lats.size() << " subgraphs, " << mismatches
+               << " mismatches (" << dl.elapsed_ms() - t_sim << " ms)" << endl;
+    }
+#endif
+    double floor_total = graph_floor(p);
+    logs() << "Compute/IO floor: " << floor_total << " (total is "
+           << 100.0 * (best.total - floor_total) / best.total << "% above it)" << endl;
+    logs() << "Solution written to " << out_path << " (" << out.writes << " writes, "
+           << dl.elapsed_ms() << " ms)" << endl;
+    return best;
+}
+
+// ============================================================
+// Batch mode (--batch=MANIFEST)
+// ============================================================
+
+// One problem per manifest line: "<input.json> [<output.json>]". Blank
+// lines and lines starting with '#' are skipped. Without an output path
+// the solution goes to <out_dir>/output-<input file name>, the name the
+// single-problem runs in this repo use.
+struct BatchJob {
+    string in, out;
+};
+
+vector<BatchJob> read_manifest(istream& is, const string& out_dir) {
+    vector<BatchJob> jobs;
+    string line;
+    while (getline(is, line)) {
+        istringstream ls(line);
+        BatchJob j;
+        if (!(ls >> j.in) || j.in[0] == '#') continue;
+        if (!(ls >> j.out)) {
+            size_t slash = j.in.find_last_of('/');
+            j.out = out_dir + "/output-" + (slash == string::npos ? j.in : j.in.substr(slash + 1));
+        }
+        jobs.push_back(move(j));
+    }
+    return jobs;
+}
+
+// Problems of a batch grouped by graph. Two problems share a group when
+// everything but fast_cap and slow_bw (and the native size, which analyze
+// does not read) is identical.
+struct AnalysisRegistry {
+    mutex mu;
+    map<vector<int64_t>, unique_ptr<SharedAnalysis>> by_graph;
+
+    static vector<int64_t> graph_key(const Problem& p) {
+        vector<int64_t> k;
+        k.reserve(2 * p.tensors.size() + 3 * p.ops.size() + p.in_idx.size() +
+                  p.out_idx.size() + 2 * p.ops.size() + 2);
+        k.push_back((int64_t)p.tensors.size());
+        for (const Tensor& t : p.tensors) { k.push_back(t.w); k.push_back(t.h); }
+        k.push_back((int64_t)p.ops.size());
+        for (const Op& op : p.ops) {
+            k.push_back((int64_t)op.kind);
+            k.push_back(op.base_cost);
+            k.push_back(op.K);
+        }
+        for (int o : p.in_off) k.push_back(o);
+        for (int t : p.in_idx) k.push_back(t);
+        for (int o : p.out_off) k.push_back(o);
+        for (int t : p.out_idx) k.push_back(t);
+        return k;
+    }
+
+    SharedAnalysis* get(const Problem& p) {
+        vector<int64_t> key = graph_key(p);
+        lock_guard<mutex> lk(mu);
+        auto& slot = by_graph[move(key)];
+        if (!slot) slot = make_unique<SharedAnalysis>();
+        return slot.get();
+    }
+};
+
+// Solves every job on `workers` threads, each problem with its own
+// o.threads-wide scoring pool and its own MLSYS_DEADLINE_MS budget. A
+// problem's progress log is dropped; one summary line per problem and a
+// throughput line go to stderr. A problem that cannot be read or written
+// is reported on its line and the batch moves on. Returns the number of
+// such problems.
+int run_batch(const vector<BatchJob>& jobs, int workers, const SolveOptions& o) {
+    AnalysisRegistry registry;
+    mutex print_mu;
+    atomic<int> next{0}, failed{0}, done{0};
+    auto t0 = chrono::steady_clock::now();
+
+    auto worker = [&] {
+        ThreadPool pool(o.threads);
+        for (int i; !g_stop && (i = next.fetch_add(1)) < (int)jobs.size();) {
+            const BatchJob& j = jobs[i];
+            Deadline dl = Deadline::from_env();
+            Problem p;
+            string err;
+            bool ok;
+            {
+                ProfScope ps("parse");
+                ok = try_read_problem(j.in.c_str(), p, err);
+            }
+            Schedule best;
+            if (ok) {
+                ostringstream log;
+                g_log = &log;
+                best = solve(p, j.out.c_str(), o, dl, pool, registry.get(p), &err);
+                g_log = &cerr;
+                ok = err.empty();
+            }
+            lock_guard<mutex> lk(print_mu);
+            cerr << "[" << i + 1 << "/" << jobs.size() << "] ";
+            if (!ok) {
+                failed++;
+                cerr << "FAILED: " << err << endl;
+                continue;
+            }
+            done++;
+            cerr << j.in << " -> " << j.out << ": " << best.sgs.size() << " subgraphs, latency "
+                 << best.total << " (" << dl.elapsed_ms() << " ms)" << endl;
+        }
+    };
+    vector<thread> extra;
+    for (int w = 1; w < workers; w++) extra.emplace_back(worker);
+    worker();
+    for (auto& t : extra) t.join();
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    int64_t hits = 0, misses = 0;
+    for (auto& [key, sa] : registry.by_graph) {
+        hits += sa->hits;
+        misses += sa->misses;
+    }
+    cerr << "Batch: " << done << " problems in " << secs << " s (" << done / max(secs, 1e-9)
+         << " problems/s, " << workers << " workers x " << o.threads << " threads); "
+         << registry.by_graph.size() << " distinct graphs, shared analysis " << hits
+         << " hits / " << misses << " misses" << endl;
+    if (failed) cerr << failed << " of " << jobs.size() << " problems failed" << endl;
+    if (g_stop) cerr << "Stopped by SIGTERM after " << done + failed << " of " << jobs.size() << endl;
+    return failed;
+}
+
+// ============================================================
+// Parameter sweep (--sweep=POINTS)
+// ============================================================
+
+struct SweepPoint {
+    int64_t fast_cap, slow_bw;
+    double latency = 0;
+    int subgraphs = 0;
+    int warm_from = -1;  // point whose partition seeded this one (-1 = cold)
+    double ms = 0;
+    bool pareto = false;
+};
+
+// "<fast_cap> <slow_bw>" per line, both positive integers; blank lines and
+// '#' comments skipped. False, after naming the line, on anything else.
+bool read_sweep_points(istream& is, vector<SweepPoint>& pts) {
+    string line;
+    for (int n = 1; getline(is, line); n++) {
+        istringstream ls(line);
+        string cap, bw, extra;
+        if (!(ls >> cap) || cap[0] == '#') continue;
+        auto positive = [](const string& f, int64_t& v) {
+            auto [end, ec] = from_chars(f.data(), f.data() + f.size(), v);
+            return ec == errc() && end == f.data() + f.size() && v > 0;
+        };
+        SweepPoint pt{0, 0};
+        if (!(ls >> bw) || (ls >> extra) || !positive(cap, pt.fast_cap) ||
+            !positive(bw, pt.slow_bw)) {
+            cerr << "Bad sweep point on line " << n << ": " << line << endl;
+            return false;
+        }
+        pts.push_back(pt);
+    }
+    return true;
+}
+
+// Solves one graph at every (fast_cap, slow_bw) point. analyze() results
+// do not depend on either, so all points share one SharedAnalysis. Points
+// run from the largest capacity down, and each bandwidth keeps one
+// CostCache that carries from point to point (CostCache::carry_to), so an
+// op set is scored once per bandwidth unless its granularity stops
+// fitting. Each point's greedy fusion starts from the partition of the
+// nearest solved point (log distance) with at least its capacity: groups
+// that still fit are contracted up front, the rest split back into single
+// ops. Seeding from a smaller capacity would lock in its small groups.
+// Unless o.warm_only, solve() also fuses cold and keeps the better, so no
+// point is worse than an independent solve.
+// Writes a CSV table to table_path, by bandwidth and then capacity; a
+// point is Pareto-optimal when no point at the same bandwidth dominates
+// it, with at most its capacity and latency and less of one.
+// Solutions go to out_dir when it is non-empty. A point whose solution
+// cannot be written is reported and left out of the table; returns 1 if
+// any was.
+int run_sweep(Problem p, vector<SweepPoint> pts, const char* table_path,
+              const string& out_dir, const SolveOptions& o) {
+    sort(pts.begin(), pts.end(), [](const SweepPoint& a, const SweepPoint& b) {
+        return a.fast_cap != b.fast_cap ? a.fast_cap > b.fast_cap : a.slow_bw < b.slow_bw;
+    });
+    SharedAnalysis shared;
+    map<int64_t, CostCache> by_bw;
+    ThreadPool pool(o.threads);
+    vector<WarmStart> warm(pts.size());  // greedy partitions of each point
+    int failed = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int i = 0; i < (int)pts.size() && !g_stop; i++) {
+        SweepPoint& pt = pts[i];
+        p.fast_cap = pt.fast_cap;
+        p.slow_bw = pt.slow_bw;
+        double best_d = 1e300;
+        for (int j = 0; j < i; j++) {
+            if (pts[j].fast_cap < pt.fast_cap || pts[j].subgraphs == 0) continue;
+            double d = fabs(log2((double)pts[j].fast_cap / pt.fast_cap)) +
+                       fabs(log2((double)pts[j].slow_bw / pt.slow_bw));
+            if (d < best_d) { best_d = d; pt.warm_from = j; }
+        }
+        string out = out_dir.empty() ? "/dev/null"
+                                     : out_dir + "/sweep-c" + to_string(pt.fast_cap) +
+                                           "-b" + to_string(pt.slow_bw) + ".json";
+        WarmStart& ws = warm[i];
+        ws.cache = &by_bw[pt.slow_bw];
+        ws.cache->carry_to(p);
+        if (pt.warm_from >= 0) {
+            ws.plain = warm[pt.warm_from].out_plain;
+            ws.handoffs = warm[pt.warm_from].out_handoffs;
+        }
+        Deadline dl = Deadline::from_env();
+        string err;
+        ostringstream log;
+        g_log = &log;
+        Schedule best = solve(p, out.c_str(), o, dl, pool, &shared, &err, &ws);
+        g_log = &cerr;
+        if (!err.empty()) {
+            failed++;
+            cerr << "[" << i + 1 << "/" << pts.size() << "] FAILED: " << err << endl;
+            pt.warm_from = -1;
+            continue;
+        }
+        pt.latency = best.total;
+        pt.subgraphs = (int)best.sgs.size();
+        pt.ms = dl.elapsed_ms();
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    vector<int> rows(pts.size());
+    iota(rows.begin(), rows.end(), 0);
+    sort(rows.begin(), rows.end(), [&](int a, int b) {
+        return pts[a].slow_bw != pts[b].slow_bw ? pts[a].slow_bw < pts[b].slow_bw
+                                                : pts[a].fast_cap < pts[b].fast_cap;
+    });
+
+    // b dominates a when it needs no more capacity for no more latency and
+    // is strictly better in one of them
+    auto dominates = [](const SweepPoint& b, const SweepPoint& a) {
+        const double eps = 1e-6;
+        return b.fast_cap <= a.fast_cap && b.latency <= a.latency + eps &&
+               (b.fast_cap < a.fast_cap || b.latency < a.latency - eps);
+    };
+    for (SweepPoint& a : pts) {
+        a.pareto = a.subgraphs > 0;
+        for (const SweepPoint& b : pts)
+            if (&b != &a && b.subgraphs > 0 && b.slow_bw == a.slow_bw && dominates(b, a))
+                a.pareto = false;
+    }
+    FILE* f = strcmp(table_path, "-") == 0 ? stdout : fopen(table_path, "w");
+    if (!f) { cerr << "Cannot write " << table_path << endl; return 1; }
+    fprintf(f, "fast_cap,slow_bw,latency,subgraphs,warm_from_cap,warm_from_bw,ms,pareto\n");
+    for (int r : rows) {
+        const SweepPoint& pt = pts[r];
+        if (pt.subgraphs == 0) continue;  // failed, or stopped before this point
+        const SweepPoint* w = pt.warm_from >= 0 ? &pts[pt.warm_from] : nullptr;
+        fprintf(f, "%lld,%lld,%.1f,%d,%lld,%lld,%.1f,%d\n", (long long)pt.fast_cap,
+                (long long)pt.slow_bw, pt.latency, pt.subgraphs,
+                (long long)(w ? w->fast_cap : 0), (long long)(w ? w->slow_bw : 0), pt.ms,
+                pt.pareto ? 1 : 0);
+    }
+    if (f != stdout) fclose(f);
+    int64_t hits = 0, misses = 0;
+    for (auto& [bw, cache] : by_bw) {
+        hits += cache.hits;
+        misses += cache.misses;
+    }
+    cerr << "Sweep: " << pts.size() << " points in " << secs << " s ("
+         << 1000 * secs / max((size_t)1, pts.size()) << " ms/point); shared analysis "
+         << shared.hits << " hits / " << shared.misses << " misses; cost cache " << hits
+         << " hits / " << misses << " misses over " << by_bw.size() << " bandwidths" << endl;
+    if (failed) cerr << failed << " of " << pts.size() << " points failed" << endl;
+    if (o.warm_only)
+        cerr << "Warm starts only (--warm-only): a point can be worse than an independent "
+                "solve of it" << endl;
+    if (g_stop) cerr << "Stopped by SIGTERM" << endl;
+    return failed ? 1 : 0;
+}
+
+// ============================================================
+// Main
+// ============================================================
+
+// Command-line help, printed on any usage error
+void usage() {
+    cerr << "Usage: ./mlsys [--threads N] [--search=greedy|beam:W] [--anneal=MS] [--lns=MS] [--recompute] [--model=tile|step] [--strips=adjacent|lru] [--fusion=final|tile] [--exact|--no-exact] [--profile[=PATH]] <input.json> <output.json>" << endl;
+    cerr << "       ./mlsys [options] [--jobs=N] [--out-dir=DIR] --batch=MANIFEST|-" << endl;
+    cerr << "       ./mlsys [options] [--out-dir=DIR] [--warm-only] --sweep=POINTS|- <input.json> <table.csv|->" << endl;
+    cerr << "       ./mlsys --bench-analyze <input.json>" << endl;
+    cerr << "  --threads N      score fusion candidates on N threads (0 = all cores)" << endl;
+    cerr << "  --search=beam:W  keep the W best partial partitions per merge step" << endl;
+    cerr << "  --anneal=MS      simulated annealing over the schedule for MS ms" << endl;
+    cerr << "  --lns=MS         re-partition schedule windows exactly for MS ms" << endl;
+    cerr << "  --recompute      clone cheap Pointwise producers into their readers (off:" << endl;
+    cerr << "                   no graph tried so far keeps a clone)" << endl;
+    cerr << "  --model=step     score per k-step with input pinning (default: per tile)" << endl;
+    cerr << "  --strips=lru     cache MatMul strips in spare fast memory (default: adjacent" << endl;
+    cerr << "                   tiles only, as PROBLEM.md charges; verify needs the same flag)" << endl;
+    cerr << "  --fusion=tile    score fusion merges with calc_latency (default: final model)" << endl;
+    cerr << "  --exact          branch-and-bound partition search (default: up to " << kExactAutoOps << " ops)" << endl;
+    cerr << "  --batch=FILE     solve every \"<input> [<output>]\" line of FILE (- = stdin)" << endl;
+    cerr << "  --jobs=N         problems solved at once in batch mode (default: all cores)" << endl;
+    cerr << "  --out-dir=DIR    batch outputs without a path go to DIR/output-<input>;" << endl;
+    cerr << "                   sweep solutions to DIR/sweep-c<cap>-b<bw>.json" << endl;
+    cerr << "  --sweep=FILE     solve the graph at every \"<fast_cap> <slow_bw>\" line of FILE," << endl;
+    cerr << "                   warm-starting each point; writes a latency/capacity table" << endl;
+    cerr << "  --warm-only      sweep: skip the cold greedy runs beside the seeded ones;" << endl;
+    cerr << "                   faster, but a point can be worse than an independent solve" << endl;
+    cerr << "  --profile=PATH   write phase timings and call counts as a Chrome trace" << endl;
+    cerr << "                   (default mlsys.trace.json; also MLSYS_PROFILE=PATH)" << endl;
+}
+
+int main(int argc, char** argv) {
+    vector<const char*> args;
+    SolveOptions o;
+    string model = "tile";
+    bool bench = false;
+    string batch, sweep;  // --batch=MANIFEST / --sweep=POINTS ("-" = stdin)
+    string out_dir;       // batch default ".", sweep default: no solutions
+    int jobs = 0;                 // batch workers, 0 = all cores
+    // Chrome trace output (--profile[=PATH] or MLSYS_PROFILE=PATH), "" = off
+    string prof_path = getenv("MLSYS_PROFILE") ? getenv("MLSYS_PROFILE") : "";
+    for (int i = 1; i < argc; i++) {
+        string a = argv[i];
+        if (a == "--threads" && i + 1 < argc) o.threads = atoi(argv[++i]);
+        else if (a.rfind("--threads=", 0) == 0) o.threads = atoi(a.c_str() + 10);
+        else if (a == "--search=greedy") o.beam_width = 0;
+        else if (a == "--search=beam") o.beam_width = 4;
+        else if (a.rfind("--search=beam:", 0) == 0) o.beam_width = max(1, atoi(a.c_str() + 14));
+        else if (a.rfind("--anneal=", 0) == 0) o.anneal_ms = atof(a.c_str() + 9);
+        else if (a.rfind("--lns=", 0) == 0) o.lns_ms = atof(a.c_str() + 6);
+        else if (a == "--recompute") o.recompute = true;
+        else if (a == "--no-recompute") o.recompute = false;
+        else if (a.rfind("--model=", 0) == 0) model = a.substr(8);
+        else if (a == "--bench-analyze") bench = true;
+        else if (a == "--strips=adjacent") g_strip_cache = StripCache::Adjacent;
+        else if (a == "--strips=lru") g_strip_cache = StripCache::Lru;
+        else if (a == "--fusion=tile") g_fuse_final = false;
+        else if (a == "--fusion=final") g_fuse_final = true;
+        else if (a == "--exact") o.exact = 1;
+        else if (a == "--no-exact") o.exact = -1;
+        else if (a == "--warm-only") o.warm_only = true;
+        else if (a.rfind("--batch=", 0) == 0) batch = a.substr(8);
+        else if (a.rfind("--sweep=", 0) == 0) sweep = a.substr(8);
+        else if (a.rfind("--out-dir=", 0) == 0) out_dir = a.substr(10);
+        else if (a.rfind("--jobs=", 0) == 0) jobs = atoi(a.c_str() + 7);
+        else if (a == "--profile") prof_path = "mlsys.trace.json";
+        else if (a.rfind("--profile=", 0) == 0) prof_path = a.substr(10);
+        else if (a.rfind("--", 0) == 0) {
+            cerr << "Unknown option " << a << endl;
+            usage();
+            return 1;
+        } else args.push_back(argv[i]);
+    }
+    if (o.threads <= 0) o.threads = max(1, (int)thread::hardware_concurrency());
+    if (jobs <= 0) jobs = max(1, (int)thread::hardware_concurrency());
+    if (model == "step") g_model = LatencyModel::Step;
+    else if (model != "tile") {
+        cerr << "Unknown --model=" << model << " (tile|step)" << endl;
+        return 1;
+    }
+
+    // Each mode takes a fixed number of positional arguments
+    size_t want = bench ? 1 : !batch.empty() ? 0 : 2;
+    if (args.size() != want) {
+        usage();
+        return 1;
+    }
+    if (bench) {
+        bench_analyze(read_problem(args[0]));
+        return 0;
+    }
+    if (!batch.empty()) {
+        signal(SIGTERM, on_stop_signal);
+        if (!prof_path.empty()) prof_enable();
+        vector<BatchJob> list;
+        if (batch == "-") {
+            list = read_manifest(cin, out_dir.empty() ? "." : out_dir);
+        } else {
+            ifstream f(batch);
+            if (!f) { cerr << "Cannot open " << batch << endl; return 1; }
+            list = read_manifest(f, out_dir.empty() ? "." : out_dir);
+        }
+        int failed = run_batch(list, max(1, min(jobs, (int)list.size())), o);
+        if (g_profile) {
+            prof_report();
+            if (!prof_write_trace(prof_path.c_str())) cerr << "Cannot write " << prof_path << endl;
+        }
+        return failed ? 1 : 0;
+    }
+    if (!sweep.empty()) {
+        signal(SIGTERM, on_stop_signal);
+        vector<SweepPoint> pts;
+        if (sweep == "-") {
+            if (!read_sweep_points(cin, pts)) return 1;
+        } else {
+            ifstream f(sweep);
+            if (!f) { cerr << "Cannot open " << sweep << endl; return 1; }
+            if (!read_sweep_points(f, pts)) return 1;
+        }
+        return run_sweep(read_problem(args[0]), move(pts), args[1], out_dir, o);
+    }
+
+    Deadline dl = Deadline::from_env();
+    signal(SIGTERM, on_stop_signal);
+    if (!prof_path.empty()) prof_enable();
+
+    Problem p;
+    {
+        ProfScope ps("parse");
+        p = read_problem(args[0]);
+    }
+    ThreadPool pool(o.threads);
+    solve(p, args[1], o, dl, pool, nullptr);
+
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        cerr << "Peak RSS: " << ru.ru_maxrss / 1024 << " MB" << endl;
+    if (g_profile) {
+        prof_report();
+        if (prof_write_trace(prof_path.c_str()))
+            cerr << "Trace written to " << prof_path << endl;
+        else
+            cerr << "Cannot write " << prof_path << endl;
+    }
     return 0;
 }
@@ -1,12 +1,17 @@
 // verify.cpp — Standalone solution validator
-// Usage: ./verify <input.json> <output.json>
+// Usage: ./verify [--model=tile|step] [--strips=adjacent|lru] <input.json> <output.json>
 //
 // Checks:
 //   1. Every op appears in exactly one subgraph
 //   2. Subgraphs are in valid topological order
 //   3. Working set fits in fast_memory_capacity per tile
-//   4. Recomputes latency per subgraph and compares to reported values
+//   4. Simulates every subgraph tile by tile (traversal order, retention,
+//      k-steps and pinning under --model=step) and compares to reported
+//      values. MatMul strips are reused between adjacent tiles only, as
+//      PROBLEM.md charges them; --strips=lru also caches older strips in
+//      spare fast memory, for solutions from ./mlsys --strips=lru
 //   5. All graph outputs are produced and evicted
+//   6. Retained tensors are held legally and fit beside the working set
 //
 // Also computes the "unfused baseline" for comparison.
 
@@ -15,157 +20,39 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
-#include <fstream>
 #include <iostream>
 #include <map>
 #include <set>
-#include <sstream>
 #include <string>
 #include <vector>
 
-using namespace std;
-
-// ---- Reuse JSON parser from solver.cpp ----
-struct JVal {
-    enum T { NUL, NUM, STR, ARR, OBJ } t = NUL;
-    double n = 0;
-    string s;
-    vector<JVal> a;
-    vector<pair<string, JVal>> o;
-    const JVal& operator[](const char* key) const {
-        for (auto& [k, v] : o) if (k == key) return v;
-        static JVal nil; return nil;
-    }
-    const JVal& operator[](size_t i) const { return a[i]; }
-    int sz() const { return t == ARR ? (int)a.size() : (int)o.size(); }
-    int64_t i64() const { return (int64_t)n; }
-};
-
-JVal jparse(const string& s, size_t& p) {
-    auto ws = [&] { while (p < s.size() && isspace(s[p])) p++; };
-    ws();
-    if (p >= s.size()) return {};
-    if (s[p] == '{') {
-        JVal v; v.t = JVal::OBJ; p++; ws();
-        while (p < s.size() && s[p] != '}') {
-            auto k = jparse(s, p); ws();
-            if (p < s.size() && s[p] == ':') p++;
-            auto val = jparse(s, p);
-            v.o.push_back({k.s, val}); ws();
-            if (p < s.size() && s[p] == ',') p++;
-        }
-        if (p < s.size()) p++; return v;
-    }
-    if (s[p] == '[') {
-        JVal v; v.t = JVal::ARR; p++; ws();
-        while (p < s.size() && s[p] != ']') {
-            v.a.push_back(jparse(s, p)); ws();
-            if (p < s.size() && s[p] == ',') p++;
-        }
-        if (p < s.size()) p++; return v;
-    }
-    if (s[p] == '"') {
-        JVal v; v.t = JVal::STR; p++;
-        while (p < s.size() && s[p] != '"') v.s += s[p++];
-        if (p < s.size()) p++; return v;
-    }
-    if (s[p] == 'n') { p += 4; return {}; }
-    JVal v; v.t = JVal::NUM;
-    size_t start = p;
-    if (s[p] == '-') p++;
-    while (p < s.size() && isdigit(s[p])) p++;
-    if (p < s.size() && s[p] == '.') { p++; while (p < s.size() && isdigit(s[p])) p++; }
-    if (p < s.size() && (s[p] == 'e' || s[p] == 'E')) {
-        p++; if (p < s.size() && (s[p] == '+' || s[p] == '-')) p++;
-        while (p < s.size() && isdigit(s[p])) p++;
-    }
-    v.n = stod(s.substr(start, p - start)); return v;
-}
-JVal jparse(const string& s) { size_t p = 0; return jparse(s, p); }
-
-// ---- Problem/Solution ----
-struct Tensor { int64_t w, h; };
-struct Op { string type; vector<int> ins, outs; int64_t base_cost; };
-
-struct Problem {
-    vector<Tensor> tensors;
-    vector<Op> ops;
-    int64_t fast_cap, slow_bw, nat_w, nat_h;
-    vector<int> producer;
-    vector<vector<int>> consumers;
-    set<int> graph_ins, graph_outs;
-};
-
-struct SolSG {
-    vector<int> ops;
-    int64_t w, h, k;
-    vector<int> retain;
-    double reported_lat;
-};
-
-Problem read_problem(const char* path) {
-    ifstream f(path); stringstream ss; ss << f.rdbuf();
-    auto j = jparse(ss.str());
-    Problem p;
-    int nt = j["widths"].sz();
-    p.tensors.resize(nt);
-    for (int i = 0; i < nt; i++)
-        p.tensors[i] = {j["widths"][(size_t)i].i64(), j["heights"][(size_t)i].i64()};
-    int no = j["inputs"].sz();
-    p.ops.resize(no);
-    for (int i = 0; i < no; i++) {
-        p.ops[i].type = j["op_types"][(size_t)i].s;
-        for (int k = 0; k < j["inputs"][(size_t)i].sz(); k++)
-            p.ops[i].ins.push_back((int)j["inputs"][(size_t)i][(size_t)k].i64());
-        for (int k = 0; k < j["outputs"][(size_t)i].sz(); k++)
-            p.ops[i].outs.push_back((int)j["outputs"][(size_t)i][(size_t)k].i64());
-        p.ops[i].base_cost = j["base_costs"][(size_t)i].i64();
-    }
-    p.fast_cap = j["fast_memory_capacity"].i64();
-    p.slow_bw = j["slow_memory_bandwidth"].i64();
-    p.nat_w = j["native_granularity"][(size_t)0].i64();
-    p.nat_h = j["native_granularity"][(size_t)1].i64();
-    p.producer.assign(nt, -1);
-    p.consumers.resize(nt);
-    for (int i = 0; i < no; i++) {
-        for (int t : p.ops[i].outs) p.producer[t] = i;
-        for (int t : p.ops[i].ins) p.consumers[t].push_back(i);
-    }
-    for (int i = 0; i < nt; i++) {
-        if (p.producer[i] < 0) p.graph_ins.insert(i);
-        if (p.consumers[i].empty()) p.graph_outs.insert(i);
-    }
-    return p;
-}
+#include "mlsys_core.h"
 
-vector<SolSG> read_solution(const char* path) {
-    ifstream f(path); stringstream ss; ss << f.rdbuf();
-    auto j = jparse(ss.str());
-    int n = j["subgraphs"].sz();
-    vector<SolSG> sgs(n);
-    for (int i = 0; i < n; i++) {
-        for (int k = 0; k < j["subgraphs"][(size_t)i].sz(); k++)
-            sgs[i].ops.push_back((int)j["subgraphs"][(size_t)i][(size_t)k].i64());
-        sgs[i].w = j["granularities"][(size_t)i][(size_t)0].i64();
-        sgs[i].h = j["granularities"][(size_t)i][(size_t)1].i64();
-        sgs[i].k = j["granularities"][(size_t)i][(size_t)2].i64();
-        if (j["tensors_to_retain"][(size_t)i].t == JVal::ARR)
-            for (int k = 0; k < j["tensors_to_retain"][(size_t)i].sz(); k++)
-                sgs[i].retain.push_back((int)j["tensors_to_retain"][(size_t)i][(size_t)k].i64());
-        sgs[i].reported_lat = j["subgraph_latencies"][(size_t)i].n;
-    }
-    return sgs;
-}
-
-// ---- Verification ----
+using namespace std;
 
-int64_t get_K(const Problem& p, int oi) { return p.tensors[p.ops[oi].ins[0]].w; }
+// Problem/solution readers, analyze, working_set and tile_latency come from
+// mlsys_core, the same code the solver scores with.
 
 int main(int argc, char** argv) {
-    if (argc < 3) { cerr << "Usage: ./verify <input.json> <output.json>\n"; return 1; }
+    vector<const char*> args;
+    SimModel model = SimModel::Tile;
+    StripCache cache = StripCache::Adjacent;
+    for (int i = 1; i < argc; i++) {
+        string a = argv[i];
+        if (a == "--model=tile") model = SimModel::Tile;
+        else if (a == "--model=step") model = SimModel::Step;
+        else if (a == "--strips=adjacent") cache = StripCache::Adjacent;
+        else if (a == "--strips=lru") cache = StripCache::Lru;
+        else if (a.rfind("--", 0) == 0) {
+            cerr << "Unknown option " << a << endl;
+            args.clear();
+            break;
+        } else args.push_back(argv[i]);
+    }
+    if (args.size() < 2) { cerr << "Usage: ./verify [--model=tile|step] [--strips=adjacent|lru] <input.json> <output.json>\n"; return 1; }
 
-    auto prob = read_problem(argv[1]);
-    auto sgs = read_solution(argv[2]);
+    auto prob = read_problem(args[0]);
+    auto sgs = read_solution(args[1]);
     int nops = (int)prob.ops.size();
     int nsg = (int)sgs.size();
     bool ok = true;
@@ -174,13 +61,30 @@ int main(int argc, char** argv) {
 
     // CHECK 1: Every op in exactly one subgraph
     vector<int> op_count(nops, 0);
-    for (auto& sg : sgs) for (int oi : sg.ops) op_count[oi]++;
+    bool ids_ok = true;
+    for (int si = 0; si < nsg; si++)
+        for (int oi : sgs[si].ops) {
+            if (oi < 0 || oi >= nops) {
+                printf("FAIL: SG[%d] lists op %d, which does not exist\n", si, oi);
+                ids_ok = false;
+                continue;
+            }
+            op_count[oi]++;
+        }
+    if (!ids_ok) {
+        printf("\n=== SOME CHECKS FAILED ===\n");
+        return 1;
+    }
     for (int i = 0; i < nops; i++) {
         if (op_count[i] == 0) { printf("FAIL: op %d not in any subgraph\n", i); ok = false; }
         // Note: ops CAN appear in multiple subgraphs (recomputation). Count ≥ 1 is valid.
     }
     printf("[%s] All ops covered (recomputation allowed)\n", ok ? "PASS" : "FAIL");
 
+    // Boundary tensors and compute per subgraph in schedule context: a
+    // recomputed op writes its outputs back only from its first copy
+    vector<SGInfo> infos = solution_infos(prob, sgs);
+
     // CHECK 2: Topological order — for each subgraph pair (i < j),
     // no tensor produced by sgs[j] should be consumed by sgs[i]
     {
@@ -190,62 +94,32 @@ int main(int argc, char** argv) {
             for (int oi : sgs[si].ops) op_to_sg[oi] = si;
 
         bool topo_ok = true;
-        for (int si = 0; si < nsg; si++) {
-            set<int> opset(sgs[si].ops.begin(), sgs[si].ops.end());
-            for (int oi : sgs[si].ops)
-                for (int t : prob.ops[oi].ins) {
-                    int prod = prob.producer[t];
-                    if (prod >= 0 && !opset.count(prod)) {
-                        // t is produced by op `prod` — its subgraph must come before si
-                        auto it = op_to_sg.find(prod);
-                        if (it != op_to_sg.end() && it->second > si) {
-                            printf("FAIL: SG[%d] consumes tensor %d produced by SG[%d] (later)\n",
-                                   si, t, it->second);
-                            topo_ok = false;
-                        }
-                    }
+        for (int si = 0; si < nsg; si++)
+            for (const InBd& b : infos[si].in_bd) {
+                int prod = prob.producer[b.t];
+                if (prod < 0) continue;
+                // b.t is produced by op `prod` — its subgraph must come before si
+                auto it = op_to_sg.find(prod);
+                if (it != op_to_sg.end() && it->second > si) {
+                    printf("FAIL: SG[%d] consumes tensor %d produced by SG[%d] (later)\n",
+                           si, b.t, it->second);
+                    topo_ok = false;
                 }
-        }
+            }
         printf("[%s] Topological order\n", topo_ok ? "PASS" : "FAIL");
         if (!topo_ok) ok = false;
     }
 
-    // CHECK 3: Working set per subgraph
+    // CHECK 3: Working set per subgraph (per-k-step slices)
     for (int si = 0; si < nsg; si++) {
-        auto& sg = sgs[si];
-        set<int> opset(sg.ops.begin(), sg.ops.end());
-        set<int> produced, consumed;
-        for (int oi : sg.ops) {
-            for (int t : prob.ops[oi].outs) produced.insert(t);
-            for (int t : prob.ops[oi].ins) consumed.insert(t);
-        }
-        set<int> in_bd, out_bd;
-        for (int t : consumed) if (!produced.count(t)) in_bd.insert(t);
-        for (int t : produced) {
-            bool ext = prob.graph_outs.count(t) > 0;
-            if (!ext) for (int c : prob.consumers[t])
-                if (!opset.count(c)) { ext = true; break; }
-            if (ext) out_bd.insert(t);
-        }
-
-        // Compute working set with per-k-step slices
-        int64_t ws = 0;
-        for (int t : in_bd) {
-            int64_t best = 0;
-            for (int oi : sg.ops) {
-                for (int j = 0; j < (int)prob.ops[oi].ins.size(); j++) {
-                    if (prob.ops[oi].ins[j] == t) {
-                        int64_t s = (prob.ops[oi].type == "MatMul")
-                            ? (j == 0 ? sg.h * sg.k : sg.w * sg.k)
-                            : sg.w * sg.h;
-                        best = max(best, s);
-                    }
-                }
-            }
-            ws += (best > 0 ? best : sg.w * sg.h);
+        const Gran& g = sgs[si].gran;
+        if (g.w <= 0 || g.h <= 0 || g.k <= 0) {
+            printf("FAIL: SG[%d] granularity [%lld, %lld, %lld] is not positive\n", si,
+                   (long long)g.w, (long long)g.h, (long long)g.k);
+            ok = false;
+            continue;
         }
-        for ([[maybe_unused]] int t : out_bd) ws += sg.w * sg.h;
-
+        int64_t ws = working_set(infos[si], g);
         if (ws > prob.fast_cap) {
             printf("FAIL: SG[%d] working set %lld > fast_cap %lld\n",
                    si, (long long)ws, (long long)prob.fast_cap);
@@ -253,153 +127,148 @@ int main(int argc, char** argv) {
         }
     }
     printf("[%s] Working set fits\n", ok ? "PASS" : "FAIL");
+    double total_recomputed = 0;
 
-    // CHECK 4: Recompute latencies (simplified model)
-    double total_reported = 0, total_recomputed = 0;
-    for (int si = 0; si < nsg; si++) {
-        auto& sg = sgs[si];
-        set<int> opset(sg.ops.begin(), sg.ops.end());
-        set<int> produced, consumed;
-        for (int oi : sg.ops) {
-            for (int t : prob.ops[oi].outs) produced.insert(t);
-            for (int t : prob.ops[oi].ins) consumed.insert(t);
-        }
-        set<int> in_bd, out_bd;
-        for (int t : consumed) if (!produced.count(t)) in_bd.insert(t);
-        for (int t : produced) {
-            bool ext = prob.graph_outs.count(t) > 0;
-            if (!ext) for (int c : prob.consumers[t])
-                if (!opset.count(c)) { ext = true; break; }
-            if (ext) out_bd.insert(t);
+    // CHECK 4: Simulate the schedule. Reported latencies must match to print
+    // precision under either model; under --model=step the simulator picks
+    // the pins the solver would have.
+    {
+        SimResult sim = simulate(prob, sgs, model, cache);
+        bool lat_ok = true;
+        for (int si : sim.bad_traversal) {
+            printf("FAIL: SG[%d] traversal order is not a permutation of its tiles\n", si);
+            lat_ok = false;
         }
-
-        int64_t out_W = 0, out_H = 0;
-        for (int oi : sg.ops)
-            for (int t : prob.ops[oi].outs) {
-                out_W = max(out_W, prob.tensors[t].w);
-                out_H = max(out_H, prob.tensors[t].h);
+        double total_reported = 0;
+        int peak_sg = 0;
+        for (int si = 0; si < nsg; si++) {
+            double lat = sim.lats[si];
+            total_reported += sgs[si].latency;
+            total_recomputed += lat;
+            if (sim.peak[si] > sim.peak[peak_sg]) peak_sg = si;
+
+            double diff = fabs(lat - sgs[si].latency);
+            if (diff > max(0.1, 1e-5 * lat)) {
+                printf("  SG[%d]: reported=%.1f recomputed=%.1f (delta=%.1f)\n",
+                       si, sgs[si].latency, lat, diff);
+                lat_ok = false;
             }
-
-        int64_t ntiles = ((out_W + sg.w - 1) / sg.w) * ((out_H + sg.h - 1) / sg.h);
-        int64_t ns = max((int64_t)1, (sg.w + prob.nat_w - 1) / prob.nat_w) *
-                     max((int64_t)1, (sg.h + prob.nat_h - 1) / prob.nat_h);
-
-        double compute = 0;
-        for (int oi : sg.ops) compute += (double)prob.ops[oi].base_cost;
-        compute *= ns;
-
-        double mem_in = 0;
-        for (int t : in_bd) {
-            int64_t best = 0;
-            for (int oi : sg.ops)
-                for (int j = 0; j < (int)prob.ops[oi].ins.size(); j++)
-                    if (prob.ops[oi].ins[j] == t) {
-                        int64_t s;
-                        if (prob.ops[oi].type == "MatMul") {
-                            int64_t K = get_K(prob, oi);
-                            s = j == 0 ? sg.h * K : sg.w * K;
-                        } else {
-                            s = sg.w * sg.h;
-                        }
-                        best = max(best, s);
-                    }
-            mem_in += (double)(best > 0 ? best : sg.w * sg.h) / prob.slow_bw;
         }
-        double mem_out = 0;
-        for ([[maybe_unused]] int t : out_bd) mem_out += (double)(sg.w * sg.h) / prob.slow_bw;
 
-        double lat = ntiles * max(compute, mem_in + mem_out);
-        total_reported += sg.reported_lat;
-        total_recomputed += lat;
-
-        double diff = fabs(lat - sg.reported_lat);
-        if (diff > 0.1) {
-            printf("  SG[%d]: reported=%.1f recomputed=%.1f (delta=%.1f)\n",
-                   si, sg.reported_lat, lat, diff);
-        }
+        printf("[INFO] Total reported latency:    %.1f\n", total_reported);
+        printf("[INFO] Total recomputed latency:  %.1f (%s model)\n", total_recomputed,
+               model == SimModel::Tile ? "tile" : "step");
+        if (nsg)
+            printf("[INFO] Peak fast-memory use:      %lld of %lld (SG[%d])\n",
+                   (long long)sim.peak[peak_sg], (long long)prob.fast_cap, peak_sg);
+        printf("[%s] Reported latencies match the simulation\n", lat_ok ? "PASS" : "FAIL");
+        if (!lat_ok) ok = false;
     }
 
-    printf("[INFO] Total reported latency:    %.1f\n", total_reported);
-    printf("[INFO] Total recomputed latency:  %.1f\n", total_recomputed);
-
     // CHECK 5: All graph outputs produced (or are pass-through graph inputs)
     {
-        set<int> all_produced;
+        vector<uint8_t> produced(prob.tensors.size(), 0);
         for (auto& sg : sgs)
             for (int oi : sg.ops)
-                for (int t : prob.ops[oi].outs) all_produced.insert(t);
+                for (int t : prob.outs(oi)) produced[t] = 1;
         bool outputs_ok = true;
-        for (int t : prob.graph_outs) {
-            if (!all_produced.count(t)) {
-                if (prob.graph_ins.count(t)) {
-                    // Tensor is both graph input and output — already in slow memory
-                    printf("  [INFO] Tensor %d is pass-through (graph in+out, no ops)\n", t);
-                } else {
-                    printf("FAIL: graph output tensor %d never produced\n", t);
-                    outputs_ok = false;
-                }
+        for (int t = 0; t < (int)prob.tensors.size(); t++) {
+            if (!prob.is_graph_out[t] || produced[t]) continue;
+            if (prob.is_graph_in[t]) {
+                // Tensor is both graph input and output — already in slow memory
+                printf("  [INFO] Tensor %d is pass-through (graph in+out, no ops)\n", t);
+            } else {
+                printf("FAIL: graph output tensor %d never produced\n", t);
+                outputs_ok = false;
             }
         }
         printf("[%s] All graph outputs produced\n", outputs_ok ? "PASS" : "FAIL");
         if (!outputs_ok) ok = false;
     }
 
-    // Unfused baseline for comparison
-    double baseline = 0;
-    for (int oi = 0; oi < nops; oi++) {
-        vector<int> single = {oi};
-        set<int> produced, consumed;
-        for (int t : prob.ops[oi].outs) produced.insert(t);
-        for (int t : prob.ops[oi].ins) consumed.insert(t);
-        set<int> in_bd, out_bd;
-        for (int t : consumed) in_bd.insert(t);
-        for (int t : produced) out_bd.insert(t);
-
-        // Best granularity for single op
-        int64_t out_W = 0, out_H = 0;
-        for (int t : prob.ops[oi].outs) {
-            out_W = max(out_W, prob.tensors[t].w);
-            out_H = max(out_H, prob.tensors[t].h);
-        }
-        int64_t maxK = 0;
-        if (prob.ops[oi].type == "MatMul") maxK = get_K(prob, oi);
+    // CHECK 6: Retention. retain[k] may only list output tensors or loaded
+    // inputs of SG k (PROBLEM.md), so a tensor stays resident across several
+    // subgraphs only if each of them reads it. While resident it occupies
+    // its full size on top of the working set. A retained output is never written back, so nothing
+    // may read it from slow memory afterwards and it cannot be a graph output.
+    {
+        bool ret_ok = true;
+        set<int> resident, unwritten;
+        for (int si = 0; si < nsg; si++) {
+            auto& sg = sgs[si];
+            const SGInfo& info = infos[si];
+            map<int, int64_t> slice;  // boundary tensor -> bytes in the working set
+            set<int> touched;         // produced or loaded by the subgraph
+            for (const InBd& b : info.in_bd) {
+                slice[b.t] = input_slice(b, sg.gran);
+                touched.insert(b.t);
+            }
+            for (int t : info.out_bd) {
+                slice[t] = sg.gran.w * sg.gran.h;
+                touched.insert(t);
+            }
+            touched.insert(info.ephem.begin(), info.ephem.end());
+            int64_t ws = working_set(info, sg.gran);
+
+            for (const InBd& b : info.in_bd)
+                if (!resident.count(b.t) && unwritten.count(b.t)) {
+                    printf("FAIL: SG[%d] loads tensor %d, which was retained and never written\n",
+                           si, b.t);
+                    ret_ok = false;
+                }
 
-        double best_single = 1e30;
-        for (int64_t w = 1; w <= max(out_W, (int64_t)1); w *= 2)
-        for (int64_t h = 1; h <= max(out_H, (int64_t)1); h *= 2)
-        for (int64_t k = 1; k <= max(maxK, (int64_t)1); k *= 2) {
-            // WS check
-            int64_t ws = 0;
-            for (int t : in_bd) {
-                for (int j = 0; j < (int)prob.ops[oi].ins.size(); j++)
-                    if (prob.ops[oi].ins[j] == t) {
-                        ws += (prob.ops[oi].type == "MatMul")
-                            ? (j == 0 ? h * k : w * k) : w * h;
-                        break;
-                    }
+            set<int> held(resident), kept;  // kept: legal entries of retain
+            for (int t : sg.retain) {
+                if (t < 0 || t >= (int)prob.tensors.size() || !touched.count(t)) {
+                    printf("FAIL: SG[%d] retains tensor %d it neither produced nor loaded\n",
+                           si, t);
+                    ret_ok = false;
+                    continue;
+                }
+                held.insert(t);
+                kept.insert(t);
+            }
+            int64_t occ = ws;
+            for (int t : held) {
+                auto it = slice.find(t);
+                occ += max((int64_t)0, prob.tensors[t].w * prob.tensors[t].h -
+                                           (it == slice.end() ? 0 : it->second));
+            }
+            if (occ > prob.fast_cap) {
+                printf("FAIL: SG[%d] working set + resident tensors %lld > fast_cap %lld\n",
+                       si, (long long)occ, (long long)prob.fast_cap);
+                ret_ok = false;
             }
-            for ([[maybe_unused]] int t : out_bd) ws += w * h;
-            if (ws > prob.fast_cap) continue;
 
-            int64_t ntiles = ((out_W + w - 1) / w) * ((out_H + h - 1) / h);
-            int64_t ns = max((int64_t)1, (w + prob.nat_w - 1) / prob.nat_w) *
-                         max((int64_t)1, (h + prob.nat_h - 1) / prob.nat_h);
-            double compute = (double)prob.ops[oi].base_cost * ns;
-            double mi = 0;
-            for (int t : in_bd) {
-                for (int j = 0; j < (int)prob.ops[oi].ins.size(); j++)
-                    if (prob.ops[oi].ins[j] == t) {
-                        int64_t K = (prob.ops[oi].type == "MatMul") ? get_K(prob, oi) : 0;
-                        int64_t s = (prob.ops[oi].type == "MatMul")
-                            ? (j == 0 ? h * K : w * K) : w * h;
-                        mi += (double)s / prob.slow_bw;
-                        break;
-                    }
+            resident = kept;
+            for (int t : info.out_bd) {
+                if (resident.count(t)) unwritten.insert(t);
+                else unwritten.erase(t);
             }
-            double mo = 0;
-            for ([[maybe_unused]] int t : out_bd) mo += (double)(w * h) / prob.slow_bw;
-            double lat = ntiles * max(compute, mi + mo);
-            best_single = min(best_single, lat);
+            for (int t : info.ephem)
+                if (resident.count(t)) unwritten.insert(t);
+        }
+        for (int t : unwritten)
+            if (prob.is_graph_out[t]) {
+                printf("FAIL: graph output %d is retained and never written\n", t);
+                ret_ok = false;
+            }
+        printf("[%s] Retention\n", ret_ok ? "PASS" : "FAIL");
+        if (!ret_ok) ok = false;
+    }
+
+    // Unfused baseline for comparison: each op alone at its best pow2 [w,h,k]
+    double baseline = 0;
+    SGInfo single;
+    for (int oi = 0; oi < nops; oi++) {
+        analyze(prob, {oi}, single);
+        double best_single = 1e30;
+        for (int64_t w = 1; w <= max(single.out_W, (int64_t)1); w *= 2)
+        for (int64_t h = 1; h <= max(single.out_H, (int64_t)1); h *= 2)
+        for (int64_t k = 1; k <= max(single.maxK, (int64_t)1); k *= 2) {
+            Gran g{w, h, k};
+            if (working_set(single, g) > prob.fast_cap) continue;
+            best_single = min(best_single, tile_latency(prob, single, g));
         }
         baseline += best_single;
     }